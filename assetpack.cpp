@@ -0,0 +1,99 @@
+#include "assetpack.h"
+#include "utils.h"
+#include <string.h>
+#ifdef _WIN32
+#include <stdio.h>
+#include <stdlib.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+extern LogStream<LOG_ERROR> errorLog;
+extern LogStream<LOG_INFO> infoLog;
+
+
+bool AssetPack::open(const char* packfile) {
+    close();
+#ifdef _WIN32
+    // no mmap here, read it all
+    FILE* file = fopen(packfile, "rb");
+    if (!file)
+        return false;
+    fseek(file, 0, SEEK_END);
+    size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    unsigned char* buffer = (unsigned char*) malloc(size);
+    if (!buffer || fread(buffer, 1, size, file) != size) {
+        errorLog << "Can't read asset pack " << packfile << "\n";
+        free(buffer);
+        fclose(file);
+        size = 0;
+        return false;
+    }
+    fclose(file);
+    data = buffer;
+#else
+    int fd = ::open(packfile, O_RDONLY);
+    if (fd == -1)
+        return false;
+    struct stat info;
+    if (fstat(fd, &info) == -1 || info.st_size == 0) {
+        ::close(fd);
+        return false;
+    }
+    void* mapped = mmap(0, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd); // the mapping stays
+    if (mapped == MAP_FAILED) {
+        errorLog << "Can't map asset pack " << packfile << "\n";
+        return false;
+    }
+    data = (const unsigned char*) mapped;
+    size = info.st_size;
+#endif
+
+    // check everything once here, so that lookups can trust the file
+    header = (const PackHeader*) data;
+    bool valid = size >= sizeof(PackHeader) && header->magic == PACK_MAGIC && header->version == PACK_VERSION
+        && (size - sizeof(PackHeader)) / sizeof(PackEntry) >= header->count;
+    if (valid) {
+        entries = (const PackEntry*) (data + sizeof(PackHeader));
+        for (uint32_t k=0; k < header->count && valid; k++) {
+            const PackEntry& entry = entries[k];
+            valid = memchr(entry.path, 0, PACK_PATH_SIZE) && entry.offset <= size
+                && (uint64_t) entry.pitch >= (uint64_t) entry.w*4 // rows of 4 byte pixels
+                && (uint64_t) entry.pitch*entry.h <= size - entry.offset;
+        }
+    }
+    if (!valid) {
+        errorLog << packfile << " is not an asset pack this version can read\n";
+        close();
+        return false;
+    }
+    infoLog << "Mapped asset pack " << packfile << " with " << (int) header->count << " images\n";
+    return true;
+}
+
+void AssetPack::close() {
+    if (!data)
+        return;
+#ifdef _WIN32
+    free((void*) data);
+#else
+    munmap((void*) data, size);
+#endif
+    data = 0;
+    size = 0;
+    header = 0;
+    entries = 0;
+}
+
+// a linear search. Packs hold a few dozen images and are looked up once per image load.
+const PackEntry* AssetPack::find(const char* path) const {
+    for (int k=0; k < getCount(); k++)
+        if (!strcmp(entries[k].path, path))
+            return &entries[k];
+    return 0;
+}
@@ -0,0 +1,63 @@
+#ifndef ASSETPACK_H
+#define ASSETPACK_H
+
+// Pre-baked images. No SDL in here, pixel formats are SDL_PixelFormatEnum values carried as plain integers.
+
+#include <stddef.h>
+#include <stdint.h>
+
+// File layout, in the byte order of the machine that packed it:
+//
+//   PackHeader
+//   PackEntry x count
+//   pixels of every entry, each starting at a multiple of PACK_ALIGN
+//
+// The pixels are stored row by row, 'pitch' bytes per row, in the header's pixel format, ready to be uploaded to a
+// texture as they are. See pack.cpp for the tool that writes packs.
+#define PACK_MAGIC 0x4b505842 // "BXPK"
+#define PACK_VERSION 1
+#define PACK_PATH_SIZE 128 // like MAX_FILEPATH_SIZE
+#define PACK_ALIGN 64
+
+struct PackHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t pixelFormat; // of all entries
+    uint32_t count; // entries
+};
+
+struct PackEntry {
+    char path[PACK_PATH_SIZE]; // as registered with Resources, null-terminated
+    uint32_t w;
+    uint32_t h;
+    uint32_t pitch; // bytes per row
+    uint32_t reserved;
+    uint64_t offset; // of the pixels from the start of the file
+};
+
+
+// A pack mapped in memory. Pixels point straight into the mapping and are good until close().
+class AssetPack {
+private:
+    const unsigned char* data = 0;
+    size_t size = 0;
+    const PackHeader* header = 0;
+    const PackEntry* entries = 0;
+
+public:
+    AssetPack() {}
+    AssetPack(const AssetPack&) = delete;
+    AssetPack& operator=(const AssetPack&) = delete;
+    ~AssetPack() { close(); }
+
+    bool open(const char* packfile); // false if the file is missing or not a pack. Errors are logged.
+    void close();
+    inline bool isOpen() const { return data != 0; }
+
+    const PackEntry* find(const char* path) const; // null if not in the pack
+    inline const void* pixels(const PackEntry* entry) const { return data + entry->offset; }
+    inline uint32_t pixelFormat() const { return header->pixelFormat; }
+    inline int getCount() const { return header ? header->count : 0; }
+};
+
+#endif // ASSETPACK_H
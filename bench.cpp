@@ -0,0 +1,396 @@
+#include "utils.h"
+LogStream<LOG_INFO> infoLog(std::cerr); // keep stdout for the results
+LogStream<LOG_ERROR> errorLog(std::cerr);
+LogStream<LOG_WARNING> warningLog(std::cerr);
+
+#include "game.h"
+#include "densepool.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Microbenchmarks of the game rules and pools. No renderer involved.
+//
+//   bench [--sizes WxH,...] [--densities D,...] [--colors C,...] [--reps N] [--only NAME,...] [--seed S]
+//
+// Every benchmark runs for each combination of board size, fill density (fraction of occupied tiles, 0..1) and
+// number of colors, on 14x8 to 1024x1024 boards unless --sizes says otherwise. Boards are rebuilt before each
+// repetition and building them is not timed. Results go to stdout as CSV, one line per combination:
+//
+//   benchmark,width,height,density,colors,reps,ops,items,median_ns_per_op,min_ns_per_op,ns_per_item
+//
+// 'ops' are the timed calls in one repetition, 'items' the boxes (or animator ticks) they processed in total.
+//
+// Benchmarks:
+//   discard         discardSameColor() on random occupied tiles
+//   gravity         one gravityEffect() on a board with holes
+//   condense        one condense() on a board where whole columns are empty with probability 1-density
+//   newcolumn       one newColumn() with the leftmost column free
+//   tick            Animations::tick() until one animation per box has finished
+//   listpool        ListPool::use() on every slot, then release() in random order
+//   densepool       the same on a DensePool
+//   listpool_iter   walking a ListPool after random use() and release(), a fraction 'density' of the slots in use
+//   densepool_iter  the same on a DensePool
+//   densepool_data  the same over DensePool::data(), without iter()
+
+
+typedef std::chrono::steady_clock Clock;
+
+struct BenchConfig {
+    int width;
+    int height;
+    float density;
+    int colors;
+};
+
+struct BenchResult {
+    long ops = 0; // per repetition
+    long items = 0; // per repetition
+    std::vector<double> nanos; // one per repetition
+};
+
+// owns a board big enough for one configuration
+struct Board {
+    Animations* animations;
+    BoxMap* boxMap;
+    BoxFactory* boxFactory;
+    Game* game;
+
+    Board(int width, int height) {
+        // at most one animator per box plus a column being fed, animations are cleared between repetitions
+        animations = new Animations(width*height + height);
+        boxMap = new BoxMap(width, height);
+        boxFactory = new BoxFactory(width*height + height);
+        game = new Game(boxMap, boxFactory, animations);
+    }
+
+    ~Board() {
+        game->clear();
+        delete game;
+        delete boxFactory;
+        delete boxMap;
+        delete animations;
+    }
+
+    BoxId randomColor(int colors) {
+        return (BoxId) randomInRange(RED_BOX, RED_BOX + colors - 1);
+    }
+
+    bool chance(float density) {
+        return rand() < density * ((float) RAND_MAX + 1);
+    }
+
+    // empty board with no animations
+    void reset() {
+        game->clear();
+    }
+
+    // every tile of columns [fromColumn, width) occupied with probability 'density'
+    void fill(const BenchConfig& config, int fromColumn = 0) {
+        reset();
+        for (int i = fromColumn; i < boxMap->width; i++)
+            for (int j = 0; j < boxMap->height; j++)
+                if (chance(config.density))
+                    game->newBoxAt(i, j, randomColor(config.colors));
+    }
+
+    // whole columns, full with probability 'density' and empty otherwise
+    void fillColumns(const BenchConfig& config) {
+        reset();
+        for (int i = 0; i < boxMap->width; i++)
+            if (chance(config.density))
+                for (int j = 0; j < boxMap->height; j++)
+                    game->newBoxAt(i, j, randomColor(config.colors));
+    }
+};
+
+static double nanosSince(Clock::time_point started) {
+    return std::chrono::duration<double, std::nano>(Clock::now() - started).count();
+}
+
+
+static void benchDiscard(Board& board, const BenchConfig& config, int reps, BenchResult& result) {
+    int clicks = std::min(1000, config.width*config.height);
+    std::vector<TilePos> targets;
+    for (int rep = 0; rep < reps; rep++) {
+        board.fill(config);
+        targets.clear();
+        for (int k = 0; k < clicks; k++) {
+            TilePos tile = {randomInRange(0, config.width-1), randomInRange(0, config.height-1)};
+            targets.push_back(tile);
+        }
+
+        int discarded = 0;
+        Clock::time_point started = Clock::now();
+        for (int k = 0; k < clicks; k++)
+            board.game->discardSameColor(targets[k].x, targets[k].y, discarded);
+        result.nanos.push_back(nanosSince(started));
+        result.ops = clicks;
+        result.items = discarded;
+    }
+}
+
+static void benchGravity(Board& board, const BenchConfig& config, int reps, BenchResult& result) {
+    for (int rep = 0; rep < reps; rep++) {
+        board.fill(config);
+
+        Clock::time_point started = Clock::now();
+        int moved = board.game->gravityEffect();
+        result.nanos.push_back(nanosSince(started));
+        result.ops = 1;
+        result.items = moved;
+    }
+}
+
+static void benchCondense(Board& board, const BenchConfig& config, int reps, BenchResult& result) {
+    for (int rep = 0; rep < reps; rep++) {
+        board.fillColumns(config);
+
+        Clock::time_point started = Clock::now();
+        board.game->condense();
+        result.nanos.push_back(nanosSince(started));
+        result.ops = 1;
+        result.items = board.animations->animators.getUsedCount(); // one per moved box
+    }
+}
+
+static void benchNewColumn(Board& board, const BenchConfig& config, int reps, BenchResult& result) {
+    for (int rep = 0; rep < reps; rep++) {
+        board.fill(config, 1);
+
+        Clock::time_point started = Clock::now();
+        board.game->newColumn();
+        result.nanos.push_back(nanosSince(started));
+        result.ops = 1;
+        result.items = board.animations->animators.getUsedCount(); // moved and new boxes
+    }
+}
+
+static void benchTick(Board& board, const BenchConfig& config, int reps, BenchResult& result) {
+    const float millis = SHIFT_MILLIS; // like the game's sideways moves
+    for (int rep = 0; rep < reps; rep++) {
+        board.fill(config);
+        BoxMap* boxMap = board.boxMap;
+        int animated = 0;
+        for (int bit = boxMap->occupied.next(0); bit != -1; bit = boxMap->occupied.next(bit+1)) {
+            int i = bit / boxMap->height;
+            int j = bit % boxMap->height;
+            Animator* animator = board.animations->getAnimatorSlot();
+            animator->set(boxMap->at(i, j), board.game->posAt(i, j+1), millis);
+            animated ++;
+        }
+
+        Clock::time_point started = Clock::now();
+        int ticks = 0;
+        while (board.animations->animators.getUsedCount()) {
+            board.animations->tick();
+            ticks ++;
+        }
+        result.nanos.push_back(nanosSince(started));
+        result.ops = ticks;
+        result.items = (long) animated * ticks;
+    }
+}
+
+// use() on every slot, then release() in random order
+template <class Pool>
+static void benchPool(Board&, const BenchConfig& config, int reps, BenchResult& result) {
+    int capacity = config.width*config.height;
+    Pool pool(capacity);
+    std::vector<typename Pool::Index> used(capacity);
+    std::mt19937 shuffler(rand());
+    for (int rep = 0; rep < reps; rep++) {
+        Clock::time_point started = Clock::now();
+        for (int k = 0; k < capacity; k++)
+            used[k] = pool.use();
+        double nanos = nanosSince(started);
+
+        std::shuffle(used.begin(), used.end(), shuffler); // not timed
+
+        started = Clock::now();
+        for (int k = 0; k < capacity; k++)
+            pool.release(used[k]);
+        result.nanos.push_back(nanos + nanosSince(started));
+        result.ops = 2*capacity;
+        result.items = 2*capacity;
+    }
+}
+
+// adds up the items in use through iter()/nextp()
+template <class Pool>
+static intptr_t sumIter(Pool& pool) {
+    intptr_t sum = 0;
+    Animator* animator;
+    typename Pool::Index it = pool.iter();
+    while (it != -1) {
+        it = pool.nextp(it, animator);
+        sum += (intptr_t) animator->sprite;
+    }
+    return sum;
+}
+
+// the same with a straight pass over the packed items
+static intptr_t sumData(DensePool<Animator,int>& pool) {
+    intptr_t sum = 0;
+    Animator* animators = pool.data();
+    for (int k = 0; k < pool.getUsedCount(); k++)
+        sum += (intptr_t) animators[k].sprite;
+    return sum;
+}
+
+// walking a pool where items were used and released in random order, 'density' of them left in use
+template <class Pool, intptr_t (*sumItems)(Pool&)>
+static void benchPoolIter(Board&, const BenchConfig& config, int reps, BenchResult& result) {
+    int capacity = config.width*config.height;
+    Pool pool(capacity);
+    std::vector<typename Pool::Index> used(capacity);
+    for (int k = 0; k < capacity; k++)
+        used[k] = pool.use();
+    std::mt19937 shuffler(rand());
+    std::shuffle(used.begin(), used.end(), shuffler);
+    for (int k = capacity*config.density; k < capacity; k++)
+        pool.release(used[k]);
+    std::uniform_int_distribution<int> sprites(0, capacity);
+    typename Pool::Index it = pool.iter();
+    Animator* animator;
+    while (it != -1) {
+        it = pool.nextp(it, animator);
+        animator->sprite = (Sprite*) (intptr_t) sprites(shuffler); // something to add up
+    }
+
+    intptr_t sum = 0;
+    for (int rep = 0; rep < reps; rep++) {
+        Clock::time_point started = Clock::now();
+        sum += sumItems(pool);
+        result.nanos.push_back(nanosSince(started));
+        result.ops = 1;
+        result.items = pool.getUsedCount();
+    }
+    if (sum == 42)
+        infoLog << "\n"; // keep the loop
+}
+
+
+struct Benchmark {
+    const char* name;
+    void (*run)(Board& board, const BenchConfig& config, int reps, BenchResult& result);
+};
+
+static const Benchmark benchmarks[] = {
+    {"discard", benchDiscard},
+    {"gravity", benchGravity},
+    {"condense", benchCondense},
+    {"newcolumn", benchNewColumn},
+    {"tick", benchTick},
+    {"listpool", benchPool<AnimatorPool>},
+    {"densepool", benchPool<DensePool<Animator,int> >},
+    {"listpool_iter", benchPoolIter<AnimatorPool, sumIter<AnimatorPool> >},
+    {"densepool_iter", benchPoolIter<DensePool<Animator,int>, sumIter<DensePool<Animator,int> > >},
+    {"densepool_data", benchPoolIter<DensePool<Animator,int>, sumData>},
+};
+
+
+static std::vector<std::string> splitList(const char* list) {
+    std::vector<std::string> items;
+    std::istringstream stream(list);
+    std::string item;
+    while (std::getline(stream, item, ','))
+        if (!item.empty())
+            items.push_back(item);
+    return items;
+}
+
+static bool selected(const std::vector<std::string>& only, const char* name) {
+    return only.empty() || std::find(only.begin(), only.end(), name) != only.end();
+}
+
+
+int main(int argc, char** args) {
+    const char* sizes = "14x8,64x64,256x256,1024x1024"; // 4096x4096 needs over 3GB, ask for it with --sizes
+    const char* densities = "0.5,0.9";
+    const char* colors = "3,6";
+    int reps = 5;
+    unsigned int seed = 1;
+    std::vector<std::string> only;
+
+    for (int i=1; i < argc; i++) {
+        bool hasValue = i+1 < argc;
+        if (!strcmp(args[i], "--sizes") && hasValue) {
+            sizes = args[++i];
+        } else if (!strcmp(args[i], "--densities") && hasValue) {
+            densities = args[++i];
+        } else if (!strcmp(args[i], "--colors") && hasValue) {
+            colors = args[++i];
+        } else if (!strcmp(args[i], "--reps") && hasValue) {
+            reps = atoi(args[++i]);
+        } else if (!strcmp(args[i], "--only") && hasValue) {
+            only = splitList(args[++i]);
+        } else if (!strcmp(args[i], "--seed") && hasValue) {
+            seed = strtoul(args[++i], 0, 10);
+        } else {
+            errorLog << "usage: " << args[0] << " [--sizes WxH,...] [--densities D,...] [--colors C,...] [--reps N] [--only NAME,...] [--seed S]\n";
+            return 1;
+        }
+    }
+    if (reps <= 0) {
+        errorLog << "reps should be positive\n";
+        return 1;
+    }
+
+    srand(seed);
+    printf("benchmark,width,height,density,colors,reps,ops,items,median_ns_per_op,min_ns_per_op,ns_per_item\n");
+
+    std::vector<std::string> sizeList = splitList(sizes);
+    std::vector<std::string> densityList = splitList(densities);
+    std::vector<std::string> colorList = splitList(colors);
+    for (size_t s = 0; s < sizeList.size(); s++) {
+        BenchConfig config;
+        if (sscanf(sizeList[s].c_str(), "%dx%d", &config.width, &config.height) != 2 || config.width <= 0 || config.height <= 0) {
+            errorLog << "bad board size '" << sizeList[s].c_str() << "'\n";
+            return 1;
+        }
+        // big boards take long to build, spend the repetitions on the small ones
+        int tiles = config.width*config.height;
+        int boardReps = tiles > (1 << 20) ? 1 : reps;
+
+        infoLog << "board " << config.width << "x" << config.height << "\n";
+        Board board(config.width, config.height);
+
+        for (size_t d = 0; d < densityList.size(); d++) {
+            config.density = atof(densityList[d].c_str());
+            for (size_t c = 0; c < colorList.size(); c++) {
+                config.colors = atoi(colorList[c].c_str());
+                if (config.colors < 1 || config.colors > GREEN_BOX) {
+                    errorLog << "colors should be 1.." << GREEN_BOX << "\n";
+                    return 1;
+                }
+
+                for (size_t b = 0; b < sizeof(benchmarks)/sizeof(benchmarks[0]); b++) {
+                    if (!selected(only, benchmarks[b].name))
+                        continue;
+                    BenchResult result;
+                    benchmarks[b].run(board, config, boardReps, result);
+                    board.reset();
+
+                    std::vector<double> nanos = result.nanos;
+                    std::sort(nanos.begin(), nanos.end());
+                    double median = nanos[nanos.size()/2];
+                    long ops = result.ops ? result.ops : 1;
+                    printf("%s,%d,%d,%g,%d,%d,%ld,%ld,%.1f,%.1f,%.2f\n", benchmarks[b].name, config.width, config.height,
+                        config.density, config.colors, boardReps, result.ops, result.items, median / ops, nanos[0] / ops,
+                        result.items ? median / result.items : 0.0);
+                    fflush(stdout);
+                }
+            }
+        }
+    }
+
+    return 0;
+}
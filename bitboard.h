@@ -0,0 +1,149 @@
+#ifndef BITBOARD_H
+#define BITBOARD_H
+
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+// A fixed size set of bits packed in 64-bit words. BoxMap keeps one per box color plus one for occupancy, so that its
+// rule passes test, count and skip tiles a word at a time instead of walking the sprite pointers tile by tile.
+// Bits past 'bitCount' in the last word are always kept clear.
+class Bitboard
+{
+public:
+    typedef uint64_t Word;
+    static const int WORD_BITS = 64;
+
+private:
+    Word* words = 0;
+    int wordCount = 0;
+    int bitCount = 0;
+
+    static int popcount(Word w) {
+        return __builtin_popcountll(w);
+    }
+
+    static int lowestBit(Word w) {
+        return __builtin_ctzll(w);
+    }
+
+    // 'count' ones starting at bit 'from' (0 <= from < WORD_BITS, from+count <= WORD_BITS)
+    static Word onesAt(int from, int count) {
+        Word ones = count >= WORD_BITS ? ~(Word) 0 : (((Word) 1 << count) - 1);
+        return ones << from;
+    }
+
+public:
+    Bitboard() {}
+    Bitboard(int bitCount) { resize(bitCount); }
+    Bitboard(const Bitboard&) = delete;
+    Bitboard& operator=(const Bitboard&) = delete;
+
+    ~Bitboard() {
+        if (words)
+            delete [] words;
+    }
+
+    // (re)allocates and clears all bits
+    void resize(int bitCount) {
+        if (words)
+            delete [] words;
+        this->bitCount = bitCount;
+        wordCount = (bitCount + WORD_BITS - 1) / WORD_BITS;
+        words = new Word[wordCount ? wordCount : 1];
+        reset();
+    }
+
+    inline int size() const { return bitCount; }
+
+    void reset() {
+        memset(words, 0, wordCount*sizeof(Word));
+    }
+
+    inline bool test(int bit) const {
+        return (words[bit / WORD_BITS] >> (bit % WORD_BITS)) & 1;
+    }
+
+    inline void set(int bit) {
+        words[bit / WORD_BITS] |= (Word) 1 << (bit % WORD_BITS);
+    }
+
+    inline void clear(int bit) {
+        words[bit / WORD_BITS] &= ~((Word) 1 << (bit % WORD_BITS));
+    }
+
+    // set 'count' bits starting at 'from'
+    void setRange(int from, int count) {
+        while (count > 0) {
+            int offset = from % WORD_BITS;
+            int chunk = WORD_BITS - offset < count ? WORD_BITS - offset : count;
+            words[from / WORD_BITS] |= onesAt(offset, chunk);
+            from += chunk;
+            count -= chunk;
+        }
+    }
+
+    // number of set bits among 'count' bits starting at 'from'
+    int countRange(int from, int count) const {
+        int total = 0;
+        while (count > 0) {
+            int offset = from % WORD_BITS;
+            int chunk = WORD_BITS - offset < count ? WORD_BITS - offset : count;
+            total += popcount(words[from / WORD_BITS] & onesAt(offset, chunk));
+            from += chunk;
+            count -= chunk;
+        }
+        return total;
+    }
+
+    // index of the first set bit at or after 'from'. -1 if none.
+    int next(int from) const {
+        if (from >= bitCount)
+            return -1;
+        int k = from / WORD_BITS;
+        Word w = words[k] & (~(Word) 0 << (from % WORD_BITS));
+        while (!w) {
+            if (++k >= wordCount)
+                return -1;
+            w = words[k];
+        }
+        return k*WORD_BITS + lowestBit(w);
+    }
+};
+
+// A Bitboard that also lists its set bits in the order they were added. Walking or clearing them costs as much as
+// the number of bits set, not the size of the board. Used to track the tiles that changed since some pass last ran.
+class BitList
+{
+public:
+    Bitboard bits;
+    std::vector<int> list;
+
+    BitList() {}
+    BitList(int bitCount) : bits(bitCount) {}
+
+    void resize(int bitCount) {
+        bits.resize(bitCount);
+        list.clear();
+    }
+
+    inline void add(int bit) {
+        if (!bits.test(bit)) {
+            bits.set(bit);
+            list.push_back(bit);
+        }
+    }
+
+    inline bool test(int bit) const { return bits.test(bit); }
+    inline bool empty() const { return list.empty(); }
+    inline int size() const { return list.size(); }
+    inline int operator[](int k) const { return list[k]; }
+
+    void clear() {
+        for (size_t k=0; k < list.size(); k++)
+            bits.clear(list[k]);
+        list.clear();
+    }
+};
+
+#endif // BITBOARD_H
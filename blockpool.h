@@ -0,0 +1,92 @@
+#ifndef BLOCKPOOL_H
+#define BLOCKPOOL_H
+
+#include <new>
+#include <utility>
+
+// Fixed size object pool. Objects are constructed in place inside preallocated blocks of 'blockCapacity' slots and
+// freed slots are kept on a free list for reuse, so once the pool is warm create()/destroy() never touch the heap.
+// If a block fills up another one of the same size is allocated. Pointers handed out stay valid until destroy().
+template <class T>
+class BlockPool
+{
+private:
+    union Slot {
+        Slot* next; // while on the free list
+        alignas(T) unsigned char storage[sizeof(T)]; // while in use
+    };
+
+    struct Block {
+        Slot* slots;
+        Block* next;
+    };
+
+    int blockCapacity;
+    Block* blocks = 0;
+    Slot* available = 0; // head of the free list
+    int usedCount = 0;
+    int blockCount = 0;
+
+    void addBlock() {
+        Block* block = new Block();
+        block->slots = new Slot[blockCapacity];
+        block->next = blocks;
+        blocks = block;
+        blockCount ++;
+
+        // chain the slots in address order so that consecutive creates get neighbouring slots
+        for (int i = blockCapacity-1; i >= 0; i--) {
+            block->slots[i].next = available;
+            available = &block->slots[i];
+        }
+    }
+
+public:
+    BlockPool(int blockCapacity) : blockCapacity(blockCapacity > 0 ? blockCapacity : 1) {
+        addBlock();
+    }
+
+    BlockPool(const BlockPool&) = delete;
+    BlockPool& operator=(const BlockPool&) = delete;
+
+    // releases the memory. Objects still in use are not destructed.
+    ~BlockPool() {
+        while (blocks) {
+            Block* next = blocks->next;
+            delete [] blocks->slots;
+            delete blocks;
+            blocks = next;
+        }
+    }
+
+    template <class... Args>
+    T* create(Args&&... args) {
+        if (!available)
+            addBlock();
+        Slot* slot = available;
+        available = slot->next;
+        usedCount ++;
+        return new (slot->storage) T(std::forward<Args>(args)...);
+    }
+
+    // 'item' should have been returned by create() of this pool
+    void destroy(T* item) {
+        if (!item)
+            return;
+        item->~T();
+        Slot* slot = reinterpret_cast<Slot*>(item);
+        slot->next = available;
+        available = slot;
+        usedCount --;
+    }
+
+    inline int getUsedCount() {
+        return usedCount;
+    }
+
+    inline int getBlockCount() {
+        return blockCount;
+    }
+};
+
+#endif // BLOCKPOOL_H
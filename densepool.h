@@ -0,0 +1,139 @@
+#ifndef DENSEPOOL_H
+#define DENSEPOOL_H
+
+#include <vector>
+
+// Same use()/release()/iter() interface as ListPool, but the items in use are packed at the front of one array, so
+// walking them with data() is a straight pass over memory. Releasing an item moves the last one into its place. Handles (the
+// Index returned by use()) stay valid until released, a sparse array maps them to the current position. Pointers to
+// the content do not: they move with the item when another one is released, so keep the handle and look it up with
+// at(). The arrays grow when the pool runs dry and never shrink.
+//
+// T is the content class, I is the index type of handles and positions
+template <class T, class I=int>
+class DensePool
+{
+public:
+    typedef I Index;
+
+private:
+    std::vector<T> items; // [0, usedCount) in use
+    std::vector<Index> handles; // handle of the item at each position
+    std::vector<Index> positions; // position of the item of each handle, -1 while available
+    std::vector<Index> available; // handles not in use
+    int usedCount;
+    int highWaterMark; // most items used at the same time
+
+    void grow(int capacity) {
+        int oldCapacity = items.size();
+        items.resize(capacity);
+        handles.resize(capacity);
+        positions.resize(capacity, -1);
+        // handed out lowest first
+        for (int h = capacity-1; h >= oldCapacity; h--)
+            available.push_back(h);
+    }
+
+public:
+
+    DensePool(int capacity) : usedCount(0), highWaterMark(0) {
+        grow(capacity > 0 ? capacity : 1);
+    }
+
+    // never -1, the pool grows when dry
+    Index use() {
+        if (available.empty())
+            grow(2*items.size());
+        Index handle = available.back();
+        available.pop_back();
+        Index position = usedCount++;
+        handles[position] = handle;
+        positions[handle] = position;
+        if (usedCount > highWaterMark)
+            highWaterMark = usedCount;
+        return handle;
+    }
+
+    // returns false if item not used. 'true' if successfully released
+    bool release(Index handle) {
+        if (handle < 0 || handle >= (Index) positions.size() || positions[handle] == -1)
+            return false;
+        Index position = positions[handle];
+        Index last = --usedCount;
+        if (position != last) {
+            items[position] = items[last];
+            handles[position] = handles[last];
+            positions[handles[position]] = position;
+        }
+        positions[handle] = -1;
+        available.push_back(handle);
+        return true;
+    }
+
+    inline T& at(Index handle) {
+        return items[positions[handle]];
+    }
+
+    // returns a new item (index) and a copy of its content
+    inline Index get(T& newItem) {
+        Index handle = use();
+        newItem = at(handle);
+        return handle;
+    }
+
+    // returns a new item (index) and a pointer to its content. The pointer is good until the next release().
+    inline Index getp(T*& newItemp) {
+        Index handle = use();
+        newItemp = &at(handle);
+        return handle;
+    }
+
+    // true if no more available items. The pool grows on the next use().
+    bool dry() {
+        return available.empty();
+    }
+
+    // never, see use()
+    bool exhausted() {
+        return false;
+    }
+
+    // Like ListPool, the Index passed around is the handle of the item nextp() returns next, so it can be released
+    // once returned. Iteration runs from the last position to the first: releasing the item just returned only moves
+    // one already visited.
+    Index iter() {
+        return usedCount ? handles[usedCount - 1] : -1;
+    }
+
+    // returns item pointed by it and advances it to next one
+    // returns -1 when no more items
+    Index nextp(Index it, T*& nextItem) {
+        if (it != -1) {
+            Index position = positions[it];
+            nextItem = &items[position];
+            return position ? handles[position - 1] : -1;
+        } else {
+            return -1;
+        }
+    }
+
+    // the items in use, packed
+    inline T* data() {
+        return items.data();
+    }
+
+    inline int getUsedCount() {
+        return usedCount;
+    }
+
+    inline int getCapacity() {
+        return items.size();
+    }
+
+    // size the pool with this to never grow again under the same load
+    inline int getHighWaterMark() {
+        return highWaterMark;
+    }
+};
+
+#endif // DENSEPOOL_H
@@ -1,14 +1,16 @@
 #include "engine.h"
 #include <SDL_image.h>
 #include "utils.h"
+#include "trace.h"
 
 
 // statically linked global var
-extern LogStream errorLog; 
-extern LogStream warningLog; 
-extern LogStream infoLog;
+extern LogStream<LOG_ERROR> errorLog; 
+extern LogStream<LOG_WARNING> warningLog; 
+extern LogStream<LOG_INFO> infoLog;
 
 bool Engine::initialize() {
+	TRACE_SCOPE("Engine::initialize");
 
 	// Initialize SDL. SDL_Init will return -1 if it fails.
 	if (SDL_Init(SDL_INIT_EVERYTHING) < 0) {
@@ -24,7 +26,10 @@ bool Engine::initialize() {
 		return false;
 	}
 
-    renderer = SDL_CreateRenderer( window, -1, SDL_RENDERER_ACCELERATED); // TODO fallback to software rendering, check SDL_RENDERER_PRESENTVSYNC
+    Uint32 rendererFlags = SDL_RENDERER_ACCELERATED;
+    if (vsync)
+        rendererFlags |= SDL_RENDERER_PRESENTVSYNC;
+    renderer = SDL_CreateRenderer( window, -1, rendererFlags); // TODO fallback to software rendering
     if (!renderer) {
         errorLog << "Error creating renderer: " << SDL_GetError() << "\n";
         SDL_DestroyWindow(window);
@@ -77,26 +82,44 @@ void MouseState::update() {
         }  
         
         previousMouseButtons = mouseButtons;          
+
+        if (events && leftPressed)
+            events->post(EVENT_MOUSE_PRESSED, packXY(mouseX, mouseY));
+        if (events && leftReleased)
+            events->post(EVENT_MOUSE_RELEASED, packXY(mouseX, mouseY));
     }
 
 }
 
 
 Texture::~Texture() {
-    if (sdlTexture) {
+    if (sdlTexture && owned) {
         SDL_DestroyTexture(sdlTexture);
     }
 }
 
-Resources::Resources(SDL_Renderer* renderer, const char* rootPath, int capacity ) : renderer(renderer), capacity(capacity) {
+Resources::Resources(SDL_Renderer* renderer, const char* rootPath, int capacity, bool atlasMode ) : renderer(renderer), capacity(capacity), atlasMode(atlasMode) {
     strncpy(this->rootPath, rootPath, MAX_FILEPATH_SIZE); // keep a local copy  // for linux
     //strncpy_s(this->rootPath, rootPath, MAX_FILEPATH_SIZE); // keep a local copy // for win
     this->rootPath[MAX_FILEPATH_SIZE-1] = 0; // null-terminate just in case
-    textures = new Texture[capacity];
+    bound = new int[capacity];
+    for (int i=0; i < capacity; i++)
+        bound[i] = -1;
 }
 
 Resources::~Resources() {
-    delete [] textures;
+    stopDecoders();
+    for (size_t k=0; k < decoded.size(); k++)
+        if (decoded[k].image)
+            SDL_FreeSurface(decoded[k].image);
+    for (size_t slot=0; slot < images.size(); slot++)
+        if (images[slot].pending)
+            SDL_FreeSurface(images[slot].pending);
+    images.clear(); // textures go before the atlas they may point into
+    delete [] bound;
+    if (atlas)
+        SDL_DestroyTexture(atlas);
+    IMG_Quit();
 }
 
 
@@ -110,150 +133,614 @@ bool Resources::init() {
     return true;	
 }
 
-bool Resources::loadImage(const char* imagefile, SDL_Texture*& texture, int& w, int& h) {
-    
-    // load sample.png into image
+SDL_Surface* Resources::loadSurface(const char* imagefile) {
+    TRACE_SCOPE("IMG_Load");
     SDL_Surface *image;
     image = IMG_Load(imagefile);
     if (!image) {
         errorLog << "IMG_Load: " << IMG_GetError() << "\n";
-        return false;
     } else {
         infoLog << "Loaded image " << imagefile << " " << image->w << "X" << image->h << "\n";
     }
-            
+    return image;
+}
+
+// the cache entry for 'imagefile'. There is one per path, made on first use.
+int Resources::slotOf(const char* imagefile) {
+    std::unordered_map<std::string, int>::iterator found = slots.find(imagefile);
+    if (found != slots.end())
+        return found->second;
+    int slot = images.size();
+    images.emplace_back();
+    images.back().path = imagefile;
+    slots[imagefile] = slot;
+    return slot;
+}
+
+// binds a decoded image with its cache entry. In atlas mode the texture is created later by done().
+bool Resources::setImage(int slot, SDL_Surface* image, bool packed) {
+    CachedImage& cached = images[slot];
+    Texture& texture = cached.texture;
+    if (packed) {
+        cached.pending = image;
+        texture.w = image->w;
+        texture.h = image->h;
+        cached.state = IMAGE_READY;
+        return true;
+    }
+
     SDL_Texture *tex = SDL_CreateTextureFromSurface(renderer, image);
     if (tex == NULL) {
         errorLog << "CreateTextureFromSurface failed: " << SDL_GetError() << "\n";
         SDL_FreeSurface(image);
+        cached.state = IMAGE_FAILED;
         return false;
-    } else {
-        texture = tex;
-        SDL_FreeSurface(image);
-        w = image->w;
-        h = image->h;
-        return true;
     }
+    setTexture(slot, tex, image->w, image->h);
+    SDL_FreeSurface(image);
+    return true;
+}
+
+void Resources::setTexture(int slot, SDL_Texture* sdlTexture, int w, int h) {
+    CachedImage& cached = images[slot];
+    Texture& texture = cached.texture;
+    texture.sdlTexture = sdlTexture;
+    texture.rect.x = 0;
+    texture.rect.y = 0;
+    texture.rect.w = w;
+    texture.rect.h = h;
+    texture.w = w;
+    texture.h = h;
+    texture.owned = true;
+    cached.state = IMAGE_READY;
+    cached.lastUsed = ++useClock;
+    residentBytes += (size_t) w*h*4;
+    evict(slot);
 }
 
-// load an image file, create a texture for it and bind it with an identifier (see game.h:ImageId)
+bool Resources::openPack(const char* packfile) {
+    if (!pack.open(packfile))
+        return false;
+    SDL_RendererInfo info;
+    bool native = false;
+    if (renderer && SDL_GetRendererInfo(renderer, &info) == 0)
+        for (Uint32 k=0; k < info.num_texture_formats; k++)
+            native = native || info.texture_formats[k] == pack.pixelFormat();
+    if (!native)
+        warningLog << "the asset pack pixel format is not native to the renderer. Textures will be converted.\n";
+    return true;
+}
+
+// Uploads the image of a cache entry from the asset pack. No decoding and no SDL_Surface in between. In atlas mode
+// there is a surface, because the atlas is built from surfaces, but it borrows the mapped pixels.
+// returns false if the image has to be loaded from its file instead
+bool Resources::loadFromPack(int slot, bool packed) {
+    TRACE_SCOPE("Resources::loadFromPack");
+    const PackEntry* entry = pack.isOpen() ? pack.find(images[slot].path.c_str()) : 0;
+    if (!entry)
+        return false;
+    void* pixels = (void*) pack.pixels(entry);
+    if (packed) {
+        SDL_Surface* image = SDL_CreateRGBSurfaceWithFormatFrom(pixels, entry->w, entry->h, 32, entry->pitch, pack.pixelFormat());
+        if (!image) {
+            errorLog << "Can't wrap packed image " << entry->path << ": " << SDL_GetError() << "\n";
+            return false;
+        }
+        return setImage(slot, image, true);
+    }
+
+    SDL_Texture* tex = SDL_CreateTexture(renderer, pack.pixelFormat(), SDL_TEXTUREACCESS_STATIC, entry->w, entry->h);
+    if (!tex || SDL_UpdateTexture(tex, NULL, pixels, entry->pitch) != 0) {
+        errorLog << "Can't upload packed image " << entry->path << ": " << SDL_GetError() << "\n";
+        if (tex)
+            SDL_DestroyTexture(tex);
+        return false;
+    }
+    SDL_SetTextureBlendMode(tex, SDL_BLENDMODE_BLEND);
+    setTexture(slot, tex, entry->w, entry->h);
+    return true;
+}
+
+// no texture. Drawing it draws nothing.
+static Texture noTexture;
+
+bool Resources::validId(int imageId, const char* caller) {
+    if (imageId < 0 || imageId >= capacity) {
+        warningLog << caller << ": no image id " << imageId << ", there are " << capacity << "\n";
+        return false;
+    }
+    return true;
+}
+
+bool Resources::validHandle(ImageHandle handle, const char* caller) {
+    if (handle.slot < 0 || handle.slot >= (int) images.size()) {
+        warningLog << caller << ": invalid image handle\n";
+        return false;
+    }
+    return true;
+}
+
+// bind 'imageId' to the image at 'imagefile'. Ids of the same path share the image.
+// returns the cache entry, -1 if the id is already taken or out of range
+int Resources::bind(const char* imagefile, int imageId, const char* caller) {
+    if (!validId(imageId, caller))
+        return -1;
+    if (bound[imageId] != -1) {
+        warningLog << caller << ": texture already set for " << imageId << "\n";
+        return -1;
+    }
+    int slot = slotOf(imagefile);
+    images[slot].refs ++; // ids are never released
+    bound[imageId] = slot;
+    return slot;
+}
+
+// Bind an image file with an identifier (see game.h:ImageId). The file is loaded by the first getImage(). In atlas
+// mode it is decoded right away and done() packs it with the others.
 bool Resources::registerImage(const char* imagefile, int imageId) {
-    SDL_Texture* sdlTexture;
-    int w, h;
-    if (textures[imageId].sdlTexture) {
-        warningLog << "registerImage: texture already set for " << imageId;
-    } else {
-        if (loadImage(imagefile, sdlTexture, w, h)) {     
-            Texture& texture = textures[imageId];
-            texture.sdlTexture = sdlTexture;
-            texture.w = w;
-            texture.h = h;
-            
-            return true;
+    int slot = bind(imagefile, imageId, "registerImage");
+    if (slot == -1)
+        return false;
+    if (!atlasMode || images[slot].state != IMAGE_NONE)
+        return true; // lazy, or the path was there already
+    if (loadFromPack(slot, true))
+        return true;
+    SDL_Surface* image = loadSurface(imagefile);
+    if (!image) {
+        images[slot].state = IMAGE_FAILED;
+        return false;
+    }
+    return setImage(slot, image, true);
+}
+
+// like registerImage() but the file is decoded right away, by a worker thread. The texture is made by a later pump().
+bool Resources::registerImageAsync(const char* imagefile, int imageId) {
+    int slot = bind(imagefile, imageId, "registerImageAsync");
+    if (slot == -1)
+        return false;
+    if (images[slot].state != IMAGE_NONE)
+        return true; // the path is loaded or on its way
+    if (loadFromPack(slot, atlasMode))
+        return true; // nothing to decode
+    if (decoders.empty()) {
+        int count = std::thread::hardware_concurrency();
+        if (count < 1)
+            count = 1;
+        if (count > 4)
+            count = 4; // decoding a handful of PNGs doesn't need more
+        stopping = false; // done() may have stopped an earlier pool
+        for (int k=0; k < count; k++)
+            decoders.push_back(std::thread(&Resources::decodeLoop, this));
+    }
+
+    images[slot].state = IMAGE_LOADING;
+    loading ++;
+    ImageJob job;
+    job.path = imagefile;
+    job.slot = slot;
+    {
+        std::lock_guard<std::mutex> lock(decodeMutex);
+        decodeQueue.push_back(job);
+    }
+    decodeWork.notify_one();
+    return true;
+}
+
+// Decoder threads. Nothing is logged in here, the outcome is reported by pump() on the render thread.
+void Resources::decodeLoop() {
+    std::unique_lock<std::mutex> lock(decodeMutex);
+    while (true) {
+        decodeWork.wait(lock, [this] { return stopping || !decodeQueue.empty(); });
+        if (stopping)
+            return;
+        ImageJob job = decodeQueue.front();
+        decodeQueue.pop_front();
+
+        lock.unlock();
+        {
+            TRACE_SCOPE("IMG_Load");
+            job.image = IMG_Load(job.path.c_str());
         }
+        if (!job.image)
+            job.error = IMG_GetError(); // SDL keeps errors per thread
+        lock.lock();
+
+        decoded.push_back(job);
+        decodeDone.notify_all();
     }
-    return false;
-    
 }
 
-// return a texture wrapper by identifier
+void Resources::stopDecoders() {
+    {
+        std::lock_guard<std::mutex> lock(decodeMutex);
+        stopping = true;
+    }
+    decodeWork.notify_all();
+    for (size_t k=0; k < decoders.size(); k++)
+        decoders[k].join();
+    decoders.clear();
+}
+
+// Always takes at least one decoded image, so a tiny budget still makes progress.
+int Resources::pump(float budgetMillis) {
+    TRACE_SCOPE("Resources::pump");
+    Uint64 started = SDL_GetPerformanceCounter();
+    Uint64 budget = budgetMillis * SDL_GetPerformanceFrequency() / 1000;
+    while (loading) {
+        ImageJob job;
+        {
+            std::lock_guard<std::mutex> lock(decodeMutex);
+            if (decoded.empty())
+                break;
+            job = decoded.front();
+            decoded.pop_front();
+        }
+        loading --;
+        if (!job.image) {
+            errorLog << "IMG_Load: " << job.error.c_str() << "\n";
+            images[job.slot].state = IMAGE_FAILED;
+        } else {
+            infoLog << "Loaded image " << job.path.c_str() << " " << job.image->w << "X" << job.image->h << "\n";
+            setImage(job.slot, job.image, atlasMode);
+        }
+        if (SDL_GetPerformanceCounter() - started >= budget)
+            break;
+    }
+    return loading;
+}
+
+ImageState Resources::imageState(const int imageId) {
+    if (!validId(imageId, "imageState"))
+        return IMAGE_FAILED;
+    return bound[imageId] == -1 ? IMAGE_NONE : images[bound[imageId]].state;
+}
+
+bool Resources::imagesLoaded(const int* imageIds, int count) {
+    for (int k=0; k < count; k++)
+        if (imageState(imageIds[k]) == IMAGE_LOADING)
+            return false;
+    return true;
+}
+
+bool Resources::waitImages(const int* imageIds, int count) {
+    while (true) {
+        pump(1000);
+        if (imagesLoaded(imageIds, count))
+            break;
+        std::unique_lock<std::mutex> lock(decodeMutex);
+        decodeDone.wait(lock, [this] { return !decoded.empty(); });
+    }
+    for (int k=0; k < count; k++)
+        if (imageState(imageIds[k]) != IMAGE_READY)
+            return false;
+    return true;
+}
+
+// Packs the pending images into a single texture. Images are laid on shelves, left to right, starting a new shelf
+// when the next image would not fit in the width the renderer allows.
+bool Resources::buildAtlas() {
+    TRACE_SCOPE("Resources::buildAtlas");
+    int maxWidth = 2048;
+    SDL_RendererInfo info;
+    if (SDL_GetRendererInfo(renderer, &info) == 0 && info.max_texture_width > 0 && info.max_texture_width < maxWidth)
+        maxWidth = info.max_texture_width;
+
+    int x = 0, y = 0, shelfHeight = 0;
+    int atlasWidth = 0;
+    int count = 0;
+    for (size_t slot=0; slot < images.size(); slot++) {
+        if (!images[slot].pending)
+            continue;
+        Texture& texture = images[slot].texture;
+        if (x > 0 && x + texture.w > maxWidth) {
+            x = 0;
+            y += shelfHeight;
+            shelfHeight = 0;
+        }
+        texture.rect.x = x;
+        texture.rect.y = y;
+        texture.rect.w = texture.w;
+        texture.rect.h = texture.h;
+        x += texture.w;
+        if (x > atlasWidth)
+            atlasWidth = x;
+        if (texture.h > shelfHeight)
+            shelfHeight = texture.h;
+        count ++;
+    }
+    if (!count)
+        return true; // nothing registered
+    int atlasHeight = y + shelfHeight;
+
+    SDL_Surface* sheet = SDL_CreateRGBSurfaceWithFormat(0, atlasWidth, atlasHeight, 32, SDL_PIXELFORMAT_RGBA32);
+    if (!sheet) {
+        errorLog << "Can't create atlas surface: " << SDL_GetError() << "\n";
+        return false;
+    }
+    for (size_t slot=0; slot < images.size(); slot++) {
+        SDL_Surface*& pending = images[slot].pending;
+        if (!pending)
+            continue;
+        SDL_SetSurfaceBlendMode(pending, SDL_BLENDMODE_NONE); // copy pixels as they are, alpha included
+        SDL_BlitSurface(pending, NULL, sheet, &images[slot].texture.rect);
+        SDL_FreeSurface(pending);
+        pending = 0;
+        images[slot].packed = true;
+    }
+
+    atlas = SDL_CreateTextureFromSurface(renderer, sheet);
+    SDL_FreeSurface(sheet);
+    if (!atlas) {
+        errorLog << "CreateTextureFromSurface failed for atlas: " << SDL_GetError() << "\n";
+        return false;
+    }
+    for (size_t slot=0; slot < images.size(); slot++) {
+        if (images[slot].packed) {
+            images[slot].texture.sdlTexture = atlas;
+            images[slot].texture.owned = false;
+        }
+    }
+    infoLog << "Packed " << count << " images in a " << atlasWidth << "X" << atlasHeight << " atlas\n";
+    return true;
+}
+
+// loads the image of a cache entry now if it is not in memory
+Texture* Resources::load(int slot) {
+    CachedImage& cached = images[slot];
+    if (cached.state == IMAGE_NONE && !loadFromPack(slot, false)) {
+        TRACE_SCOPE("Resources::load");
+        SDL_Surface* image = loadSurface(cached.path.c_str());
+        if (image)
+            setImage(slot, image, false);
+        else
+            cached.state = IMAGE_FAILED;
+    }
+    cached.lastUsed = ++useClock;
+    return &cached.texture;
+}
+
+// Frees the least recently used textures until the budget is met. Only images nobody holds a handle or an id of are
+// freed, and never 'keep'. A linear pass per eviction, the cache is expected to hold hundreds of images, not millions.
+void Resources::evict(int keep) {
+    while (vramBudget && residentBytes > vramBudget) {
+        int oldest = -1;
+        for (size_t slot=0; slot < images.size(); slot++) {
+            CachedImage& cached = images[slot];
+            if ((int) slot == keep || cached.refs || cached.packed || !cached.texture.sdlTexture)
+                continue;
+            if (oldest == -1 || cached.lastUsed < images[oldest].lastUsed)
+                oldest = slot;
+        }
+        if (oldest == -1)
+            return; // everything in memory is in use
+        Texture& texture = images[oldest].texture;
+        residentBytes -= (size_t) texture.w*texture.h*4;
+        SDL_DestroyTexture(texture.sdlTexture);
+        texture.sdlTexture = 0;
+        images[oldest].state = IMAGE_NONE; // loaded again when needed
+        evicted ++;
+        TRACE_INSTANT("Resources::evict");
+    }
+}
+
+void Resources::setVramBudget(size_t bytes) {
+    vramBudget = bytes;
+    evict(-1);
+}
+
+// return a texture wrapper by identifier. Loads the image if it is not in memory.
 Texture* Resources::getImage(const int imageId) {
-    return &textures[imageId];
+    if (!validId(imageId, "getImage") || bound[imageId] == -1)
+        return &noTexture;
+    return load(bound[imageId]);
+}
+
+ImageHandle Resources::acquireImage(const char* imagefile) {
+    ImageHandle handle;
+    handle.slot = slotOf(imagefile);
+    images[handle.slot].refs ++;
+    return handle;
 }
 
-// release image fascilities
+ImageHandle Resources::acquireImage(const int imageId) {
+    ImageHandle handle;
+    if (!validId(imageId, "acquireImage") || bound[imageId] == -1)
+        return handle;
+    handle.slot = bound[imageId];
+    images[handle.slot].refs ++;
+    return handle;
+}
+
+void Resources::releaseImage(ImageHandle handle) {
+    if (handle.slot == -1 || !validHandle(handle, "releaseImage")) // nothing acquired
+        return;
+    if (images[handle.slot].refs > 0)
+        images[handle.slot].refs --;
+    evict(-1);
+}
+
+Texture* Resources::getImage(ImageHandle handle) {
+    if (!validHandle(handle, "getImage"))
+        return &noTexture;
+    return load(handle.slot);
+}
+
+// finish registering images. Waits for the async ones and builds the atlas in atlas mode.
 void Resources::done() {
-    IMG_Quit();
+    while (loading) {
+        pump(1000);
+        if (!loading)
+            break;
+        std::unique_lock<std::mutex> lock(decodeMutex);
+        decodeDone.wait(lock, [this] { return !decoded.empty(); });
+    }
+    stopDecoders();
+    if (atlasMode)
+        buildAtlas();
 }
 
 
 // if no blit width/height given will use the width/height of the texture
-RenderableBitmap::RenderableBitmap(Texture* texture, int blitWidth, int blitHeight) : sdlTexture(texture->sdlTexture) {
-    sourceRect = new SDL_Rect();
-    sourceRect->x = 0;
-    sourceRect->y = 0;
-    sourceRect->w = texture->w;
-    sourceRect->h = texture->h;
-    
+RenderableBitmap::RenderableBitmap(Resources* resources, ImageHandle handle, int blitWidth, int blitHeight) : resources(resources), handle(handle) {
+    Texture* texture = resources->getImage(handle);
     this->blitWidth = blitWidth ?  blitWidth : texture->w;
     this->blitHeight = blitHeight ? blitHeight : texture->h;
 }
 
 RenderableBitmap::~RenderableBitmap() {
-    if (sourceRect)
-        delete sourceRect;
+    resources->releaseImage(handle);
 }
 
-void RenderableBitmap::render(float x, float y, SDL_Rect& clippedSourceRect, Engine* engine) {
+void RenderableBitmap::render(float x, float y, SDL_Rect& clippedSourceRect, Engine* engine) const {
     SDL_Rect destRect;
     destRect.x = x + clippedSourceRect.x;
     destRect.y = y + clippedSourceRect.y;
     destRect.w = clippedSourceRect.w;
     destRect.h = clippedSourceRect.h;
-    //SDL_RenderCopy(engine->renderer, sdlTexture, sourceRect, &destRect);
-    SDL_RenderCopy(engine->renderer, sdlTexture, &clippedSourceRect, &destRect);
+    Texture* texture = resources->getImage(handle);
+    if (!texture->sdlTexture)
+        return; // failed or still loading
+    SDL_Rect textureRect = clippedSourceRect; // clipped part of the image, placed where the image lies in the texture
+    textureRect.x += texture->rect.x;
+    textureRect.y += texture->rect.y;
+    SDL_RenderCopy(engine->renderer, texture->sdlTexture, &textureRect, &destRect);
 }
 
-
-void Sprite::setPos(float x, float y) {
-    // TODO - check limits ?
-    pos.x = x;
-    pos.y = y;
+void RenderableBitmap::queue(float x, float y, SDL_Rect& clippedSourceRect, SpriteBatch* batch) const {
+    SDL_FRect destRect;
+    destRect.x = x + clippedSourceRect.x;
+    destRect.y = y + clippedSourceRect.y;
+    destRect.w = clippedSourceRect.w;
+    destRect.h = clippedSourceRect.h;
+    Texture* texture = resources->getImage(handle);
+    if (!texture->sdlTexture)
+        return; // failed or still loading
+    if (texture->sdlTexture != measured) { // first draw, or the image moved to another texture
+        measured = texture->sdlTexture;
+        int w = 0, h = 0;
+        SDL_QueryTexture(measured, NULL, NULL, &w, &h);
+        textureWidth = w;
+        textureHeight = h;
+    }
+    SDL_Rect textureRect = clippedSourceRect;
+    textureRect.x += texture->rect.x;
+    textureRect.y += texture->rect.y;
+    batch->add(texture->sdlTexture, textureWidth, textureHeight, textureRect, destRect);
 }
 
-void Sprite::render(Engine* engine) {
-    Point2 screenCoords;
-    engine->worldToScreen(pos, screenCoords);
-    SDL_Rect clippedSourceRect; // rect inside the source image
-    if (engine->clipping->clipped(screenCoords, renderable->blitWidth, renderable->blitHeight, clippedSourceRect)) {
-        return; // lies outside the viewport
+
+void SpriteBatch::add(SDL_Texture* texture, float textureWidth, float textureHeight, const SDL_Rect& textureRect, const SDL_FRect& destRect) {
+    if (lastBucket == -1 || buckets[lastBucket].texture != texture) {
+        lastBucket = -1;
+        for (size_t i=0; i < buckets.size(); i++) {
+            if (buckets[i].texture == texture) {
+                lastBucket = i;
+                break;
+            }
+        }
+        if (lastBucket == -1) {
+            buckets.push_back(Bucket());
+            lastBucket = buckets.size()-1;
+            buckets[lastBucket].texture = texture;
+        }
     }
-    renderable->render(pos.x, pos.y, clippedSourceRect, engine);
+    Bucket& bucket = buckets[lastBucket];
+
+    float u0 = textureRect.x / textureWidth;
+    float v0 = textureRect.y / textureHeight;
+    float u1 = (textureRect.x + textureRect.w) / textureWidth;
+    float v1 = (textureRect.y + textureRect.h) / textureHeight;
+    SDL_Color white = {255, 255, 255, 255};
+
+    int first = bucket.vertices.size();
+    SDL_Vertex vertex;
+    vertex.color = white;
+    vertex.position.x = destRect.x;               vertex.position.y = destRect.y;
+    vertex.tex_coord.x = u0;                      vertex.tex_coord.y = v0;
+    bucket.vertices.push_back(vertex);
+    vertex.position.x = destRect.x + destRect.w;  vertex.position.y = destRect.y;
+    vertex.tex_coord.x = u1;                      vertex.tex_coord.y = v0;
+    bucket.vertices.push_back(vertex);
+    vertex.position.x = destRect.x + destRect.w;  vertex.position.y = destRect.y + destRect.h;
+    vertex.tex_coord.x = u1;                      vertex.tex_coord.y = v1;
+    bucket.vertices.push_back(vertex);
+    vertex.position.x = destRect.x;               vertex.position.y = destRect.y + destRect.h;
+    vertex.tex_coord.x = u0;                      vertex.tex_coord.y = v1;
+    bucket.vertices.push_back(vertex);
+
+    // two triangles per quad
+    bucket.indices.push_back(first);
+    bucket.indices.push_back(first+1);
+    bucket.indices.push_back(first+2);
+    bucket.indices.push_back(first);
+    bucket.indices.push_back(first+2);
+    bucket.indices.push_back(first+3);
 }
 
-bool Animator::tick() {
-    if (steps <= 0) {
-        warningLog << "trying to move a sprite that has already reached its destination. Maybe done-event missed ?\n";
-        return true;
-    } else
-    if (steps == 1) {
-        sprite->pos = toPos;
-        steps --;
-        return true;
-    } else {
-        float stepX = (toPos.x - sprite->pos.x)/(float)steps;
-        float stepY = (toPos.y - sprite->pos.y)/(float)steps;
-        sprite->pos.x += stepX;
-        sprite->pos.y += stepY;
-        steps --;
-        return false;
+// submit all queued quads, one call per texture, and empty the batch
+void SpriteBatch::flush(SDL_Renderer* renderer) {
+    TRACE_SCOPE("SpriteBatch::flush");
+    drawCalls = 0;
+    quads = 0;
+    for (size_t i=0; i < buckets.size(); i++) {
+        Bucket& bucket = buckets[i];
+        if (bucket.indices.empty())
+            continue;
+        if (SDL_RenderGeometry(renderer, bucket.texture, &bucket.vertices[0], bucket.vertices.size(), &bucket.indices[0], bucket.indices.size()) != 0)
+            errorLog << "SDL_RenderGeometry failed: " << SDL_GetError() << "\n";
+        drawCalls ++;
+        quads += bucket.vertices.size() / 4;
+        bucket.vertices.clear(); // keeps the capacity
+        bucket.indices.clear();
     }
 }
 
-// go through animation slots and tick each one of them
-void Animations::tick() {
-    AnimatorPool::Index it, nextit;
-
-    it = animators.iter();
 
-    Animator* animp;
-    while (it != -1) {
-        nextit = animators.nextp(it, animp);
-        if (animp->tick())  // returns true finished
-            animators.release(it); // current (it) can be released since we've already got next one
-        it = nextit;
+void Sprite::render(Engine* engine) {
+    Animations* animations = engine->animations;
+    Point2 drawPos = animator ? animations->positionOf(this, animations->time() + engine->interpolation*animations->tickMillis) : pos;
+    Point2 screenCoords;
+    engine->worldToScreen(drawPos, screenCoords);
+    SDL_Rect clippedSourceRect; // rect inside the source image
+    if (engine->clipping->clipped(screenCoords, renderable->blitWidth, renderable->blitHeight, clippedSourceRect)) {
+        return; // lies outside the viewport
     }
+    if (engine->batching)
+        renderable->queue(screenCoords.x, screenCoords.y, clippedSourceRect, &engine->batch);
+    else
+        renderable->render(screenCoords.x, screenCoords.y, clippedSourceRect, engine);
 }
 
-// return an available animator and mark it as non-finished
-Animator* Animations::getAnimatorSlot() {
-    Animator* animatorp;
-    AnimatorPool::Index i = animators.getp(animatorp);
-    if (i == -1) {
-        errorLog << "no animator slots available" << "\n";
-        return 0;
+
+void FrameTimeOverlay::render(SDL_Renderer* renderer, const FrameTimer* timer) const {
+    static const Uint8 colors[PHASE_COUNT][3] = {
+        {200, 200, 0}, {200, 120, 0}, {0, 160, 255}, {0, 100, 255}, {0, 200, 200}, {220, 0, 220}, {0, 200, 0}, {200, 0, 0}, {255, 255, 255}
+    };
+    const float pixelsPerMicro = budgetWidth / 16666.7f;
+
+    SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
+    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 160);
+    SDL_Rect background = {(int) pos.x - 2, (int) pos.y - 2, (int) (budgetWidth*2) + 4, PHASE_COUNT*rowHeight + 4};
+    SDL_RenderFillRect(renderer, &background);
+
+    for (int phase = 0; phase < PHASE_COUNT; phase++) {
+        float p50 = timer->percentile((FramePhase) phase, 0.5f) * pixelsPerMicro;
+        float p99 = timer->percentile((FramePhase) phase, 0.99f) * pixelsPerMicro;
+        float max = timer->max((FramePhase) phase) * pixelsPerMicro;
+        float limit = budgetWidth*2; // bars longer than two frames get cut
+        int y = pos.y + phase*rowHeight;
+
+        SDL_SetRenderDrawColor(renderer, colors[phase][0], colors[phase][1], colors[phase][2], 255);
+        SDL_Rect bar = {(int) pos.x, y, (int) (p50 < limit ? p50 : limit) + 1, rowHeight - 1};
+        SDL_RenderFillRect(renderer, &bar);
+        SDL_SetRenderDrawColor(renderer, colors[phase][0], colors[phase][1], colors[phase][2], 128);
+        SDL_Rect tail = {(int) pos.x, y + rowHeight/2 - 1, (int) (p99 < limit ? p99 : limit) + 1, 2};
+        SDL_RenderFillRect(renderer, &tail);
+        int maxX = pos.x + (max < limit ? max : limit);
+        SDL_RenderDrawLine(renderer, maxX, y, maxX, y + rowHeight - 2);
     }
 
-    animatorp->removeIndex = i;
-    return animatorp;
+    SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
+    SDL_RenderDrawLine(renderer, pos.x + budgetWidth, pos.y - 2, pos.x + budgetWidth, pos.y + PHASE_COUNT*rowHeight + 1);
+    SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_NONE);
 }
@@ -2,25 +2,23 @@
 #define _ENGINE_H_
 
 #include <SDL.h>
-#include "listpool.h"
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "sprite.h"
+#include "frametimer.h"
+#include "assetpack.h"
 
 #define MAX_FILEPATH_SIZE 128
 
-
-struct Point2 {
-    float x;
-    float y;
-    
-    Point2() : x(0), y(0) {}
-    Point2(float x, float y) : x(x), y(y) {}
-
-    Point2 operator-(const Point2& subtracted) const {
-        Point2 result;
-        result.x = x - subtracted.x;
-        result.y = y - subtracted.y;
-        return result;
-    }
-};
+// SpriteBatch draws with SDL_RenderGeometry() and SDL_Vertex, both new in SDL 2.0.18. CMakeLists.txt asks for it too.
+#if !SDL_VERSION_ATLEAST(2,0,18)
+#error "SDL 2.0.18 or newer is needed"
+#endif
 
 
 // statefull mouse state
@@ -35,26 +33,12 @@ public:
     int mouseY;
     bool leftPressed = false;
     bool leftReleased = false;
+    EventQueue* events = 0; // not owned. When set, left button presses and releases are posted here too.
 
     void update();
 };
 
 
-// forward declarations
-struct Animations;
-
-class Camera {
-public:
-    Point2 worldPos;
-
-    Camera() : worldPos(Point2()) {} // place camera at world position (0,0)
-
-    void place(float worldx, float worldy) {
-        worldPos.x = worldx;
-        worldPos.y = worldy;
-    }
-};
-
 class Clipping {
     Point2 pos; // screen coordinates
     float width;
@@ -70,6 +54,10 @@ public:
         this->height = height;
     }
 
+    const Point2& getPos() const { return pos; }
+    float getWidth() const { return width; }
+    float getHeight() const { return height; }
+
     // true if totally clipped
     bool clipped(const Point2& screenCoords, const float blitWidth, const float blitHeight, SDL_Rect& clippedRect) {
         // check if out of the viewport alltogether
@@ -102,6 +90,29 @@ public:
 };
 
 
+// Collects textured quads and draws them with a single SDL_RenderGeometry() call per texture, instead of one
+// SDL_RenderCopy() per sprite. Quads arrive already clipped. Buffers are kept between frames so that a warm batch
+// does not allocate.
+class SpriteBatch {
+private:
+    struct Bucket {
+        SDL_Texture* texture;
+        std::vector<SDL_Vertex> vertices;
+        std::vector<int> indices;
+    };
+    std::vector<Bucket> buckets; // one per texture seen so far
+    int lastBucket = -1;
+
+public:
+    int drawCalls = 0; // SDL_RenderGeometry() calls made by the last flush()
+    int quads = 0; // drawn by the last flush()
+
+    // 'textureRect' in texels of a textureWidth x textureHeight texture, 'destRect' in screen coordinates
+    void add(SDL_Texture* texture, float textureWidth, float textureHeight, const SDL_Rect& textureRect, const SDL_FRect& destRect);
+    void flush(SDL_Renderer* renderer);
+};
+
+
 class Engine {
 public:
 	SDL_Window* window = 0;
@@ -114,6 +125,10 @@ public:
     Animations* animations; // not owned
     Camera* camera; // owned
     Clipping* clipping; // owned
+    SpriteBatch batch;
+    bool batching = true; // Sprite::render() queues to 'batch' instead of drawing. Someone has to flush it.
+    bool vsync = true; // sync presenting with the display. Set before initialize().
+    float interpolation = 0; // how far past the last simulation tick we are rendering, in ticks. 0..1
 
     Engine(Animations* animations) : animations(animations) {
         camera = new Camera();
@@ -135,117 +150,177 @@ public:
 };
 
 
+// Draws FrameTimer statistics over the game. There is no text rendering, so it is one row per phase in FramePhase
+// order: a bar up to p50, a thin bar up to p99 and a mark at the max. A white line marks the 60Hz frame budget.
+class FrameTimeOverlay {
+public:
+    Point2 pos; // screen coordinates
+    float budgetWidth = 300; // pixels for 16.6ms
+    int rowHeight = 6;
+
+    void render(SDL_Renderer* renderer, const FrameTimer* timer) const;
+};
+
+
 // convenience wrapper class of SDL_Texture
 class Texture {
 public:
     SDL_Texture* sdlTexture = 0;
+    SDL_Rect rect = {0, 0, 0, 0}; // where the image lies in sdlTexture. All of it, unless packed in an atlas.
     int w = 0;
     int h = 0;
+    bool owned = true; // false when sdlTexture is an atlas shared with other images. Resources destroys that.
     
     ~Texture();
 };
 
 
+enum ImageState {
+    IMAGE_NONE, // not in memory
+    IMAGE_LOADING,
+    IMAGE_READY,
+    IMAGE_FAILED
+};
+
+// a reference to an image of the Resources cache. See Resources::acquireImage().
+struct ImageHandle {
+    int slot = -1;
+};
+
+// Loads images and hands them out by identifier (ImageId) or by handle. Images are cached by path, so the same file
+// is loaded once however many ids or handles point to it, and only when someone first asks for it with getImage().
+// In atlas mode registerImage() decodes the image right away and done() packs all of them into a single texture.
+// getImage() then returns that texture along with the image's rect in it, so everything can be drawn without
+// switching textures.
+//
+// Images that nothing refers to stay loaded until the textures outgrow the VRAM budget, then the least recently used
+// go first. Ids always refer to their image, handles do until releaseImage(). RenderableBitmap holds a handle, so what
+// is on screen is never evicted. The Texture pointers getImage() returns stay valid until the Resources are
+// destroyed, evicted ones just lose their texture until they are asked for again.
+//
+// With an asset pack open (see openPack() and pack.cpp) the images it holds are not decoded at all. Their pixels are
+// uploaded from the mapped file as they are.
+//
+// registerImageAsync() decodes on a pool of worker threads instead. Textures can only be made on the render thread, so
+// the decoded images wait there until pump() is called, typically once per frame with a time budget. Use
+// imagesLoaded() to poll for a group of images or waitImages() to block on them. done() waits for all of them.
 class Resources {
 private:
+    struct CachedImage {
+        std::string path;
+        Texture texture;
+        ImageState state = IMAGE_NONE;
+        int refs = 0; // ids bound to it and handles acquired
+        uint64_t lastUsed = 0; // useClock when last asked for
+        SDL_Surface* pending = 0; // atlas mode. Decoded image waiting for buildAtlas().
+        bool packed = false; // in the atlas. Never evicted.
+    };
+
+    struct ImageJob {
+        std::string path;
+        int slot;
+        SDL_Surface* image = 0; // null if decoding failed
+        std::string error;
+    };
+
     char rootPath[MAX_FILEPATH_SIZE];
     SDL_Renderer* renderer;
-    Texture* textures ;
-    int capacity; // number of slots in 'textures' 
+    std::deque<CachedImage> images; // cache entries, by slot. A deque, so that Texture pointers stay put.
+    std::unordered_map<std::string, int> slots; // path -> slot
+    int* bound; // ImageId -> slot, -1 if not registered
+    int capacity; // number of ImageIds
+    bool atlasMode;
+    SDL_Texture* atlas = 0; // owned
+    AssetPack pack;
+    size_t vramBudget = 0; // bytes of textures to keep loaded. No limit if 0.
+    size_t residentBytes = 0; // of the textures loaded, the atlas excluded
+    uint64_t useClock = 0;
+    long evicted = 0;
+
+    // async decoding. The queues are shared with the decoders, everything else is for the render thread only.
+    std::vector<std::thread> decoders; // started by the first registerImageAsync()
+    std::mutex decodeMutex;
+    std::condition_variable decodeWork; // a job was queued or the decoders should stop
+    std::condition_variable decodeDone; // an image was decoded
+    std::deque<ImageJob> decodeQueue; // waiting for a decoder
+    std::deque<ImageJob> decoded; // waiting for pump()
+    bool stopping = false;
+    int loading = 0; // registered async and not through pump() yet
     
-    bool loadImage(const char* imagefile, SDL_Texture*& texture, int& w, int& h);
+    SDL_Surface* loadSurface(const char* imagefile);
+    int slotOf(const char* imagefile);
+    int bind(const char* imagefile, int imageId, const char* caller);
+    bool validId(int imageId, const char* caller);
+    bool validHandle(ImageHandle handle, const char* caller);
+    bool setImage(int slot, SDL_Surface* image, bool packed); // takes over 'image'
+    void setTexture(int slot, SDL_Texture* texture, int w, int h);
+    bool loadFromPack(int slot, bool packed);
+    Texture* load(int slot);
+    void evict(int keep);
+    bool buildAtlas();
+    void decodeLoop(); // decoder threads
+    void stopDecoders();
     
 public:
 
-    Resources(SDL_Renderer* renderer, const char* rootPath = "", int capacity = 16);
+    Resources(SDL_Renderer* renderer, const char* rootPath = "", int capacity = 16, bool atlasMode = false);
     ~Resources();
 
 	bool init();
-    bool registerImage(const char* imagefile, int imageId);
+    bool openPack(const char* packfile); // before registering images. False if there is no usable pack.
+    bool registerImage(const char* imagefile, int imageId); // false if 'imageId' is already taken
+    bool registerImageAsync(const char* imagefile, int imageId);
+    int pump(float budgetMillis); // turns decoded images into textures for up to 'budgetMillis'. Returns how many are still loading.
+    bool imagesLoaded(const int* imageIds, int count); // false while any of them is loading. Failed ones are done too.
+    bool waitImages(const int* imageIds, int count); // blocks until they are loaded. False if any failed.
+    ImageState imageState(const int imageId);
     Texture* getImage(const int imageId);
-    void done(); // unload image loading stuff
+
+    ImageHandle acquireImage(const char* imagefile); // nothing is loaded until getImage()
+    ImageHandle acquireImage(const int imageId); // the image bound to 'imageId'. An empty handle if there is none.
+    void releaseImage(ImageHandle handle);
+    Texture* getImage(ImageHandle handle);
+    void setVramBudget(size_t bytes); // 0 for no limit
+    inline size_t getResidentBytes() { return residentBytes; }
+    inline long getEvictedCount() { return evicted; }
+
+    void done(); // Waits for the async images and builds the atlas in atlas mode.
     
 };
 
 
 // something rectangular that can be rendered to the screen
+// Renderables are shared between sprites (see BitmapBoxFactory) so rendering should not change them.
 class Renderable {
 private:
 public:
-    virtual void render(float x, float y, SDL_Rect& clippedSourceRect, Engine* engine) = 0;
+    virtual ~Renderable() {}
+    virtual void render(float x, float y, SDL_Rect& clippedSourceRect, Engine* engine) const = 0;
+    virtual void queue(float x, float y, SDL_Rect& clippedSourceRect, SpriteBatch* batch) const = 0; // like render() but batched
 
 	float blitWidth = 10;
 	float blitHeight = 10;   
 };
 
 
-// a renderable based on a raster graphic source
+// a renderable based on a raster graphic source. The texture is looked up in the Resources on every draw, so it is
+// loaded again if it was ever evicted.
 class RenderableBitmap : public Renderable {
 private:
-	SDL_Texture* sdlTexture = 0; // does not own texture
-    SDL_Rect* sourceRect = 0; // source rectangle within texture. If null the whole texture is assumed. Owned by RenderableBitmap.
+    Resources* resources;
+    ImageHandle handle; // owned, released by the destructor
+    mutable SDL_Texture* measured = 0; // the texture textureWidth and textureHeight are of
+    mutable float textureWidth = 0; // of the whole texture. An atlas may hold more than this bitmap.
+    mutable float textureHeight = 0;
 	
 public:
-    RenderableBitmap(Texture* texture, int blitWidth = 0, int blitHeight = 0);
-    ~RenderableBitmap();
-
-    virtual void render(float x, float y, SDL_Rect& clippedSourceRect, Engine* engine);
-
-};
-
-
-class Sprite {
-public:
-    Renderable* renderable;
-    Point2 pos;
-    
-    Sprite(Renderable* renderable) : renderable(renderable) {}
-    
-    void setPos(float x, float y);
-    void setPos(const Point2& pos) {
-        this->pos = pos;
-    }
-    void render(Engine* engine);
-    
-};
-
-struct Animator; // forward declaration
-typedef ListPool<Animator,int> AnimatorPool;
-
-// moving a sprite is done by an animator. Knows the final destinations (toPos). Set 'finished' to mark it done.
-struct Animator {
-    AnimatorPool::Index removeIndex;
-    Sprite* sprite;
-    Point2 toPos;
-    int steps; // how many steps/frames remaining
-
-    Animator() : sprite(0), steps(0) {}
-
-    // Move sprite one step further. Returns true when done.
-    bool tick();
+    RenderableBitmap(Resources* resources, ImageHandle handle, int blitWidth = 0, int blitHeight = 0); // takes over 'handle'
+    virtual ~RenderableBitmap();
 
-    // initiate the animation
-    void set(Sprite* sprite, Point2 pos, int steps) {
-        this->sprite = sprite;
-        this->toPos = pos;
-        this->steps = steps; // TODO - make this parametric
-    }
+    virtual void render(float x, float y, SDL_Rect& clippedSourceRect, Engine* engine) const;
+    virtual void queue(float x, float y, SDL_Rect& clippedSourceRect, SpriteBatch* batch) const;
 
 };
 
-// a (not efficient) pool for Animators
-struct Animations {
-    AnimatorPool animators;
-
-    Animations(int count = 10) :animators(count) {}
-    ~Animations() {}
-
-    // go through animation slots and tick each one of them
-    void tick();
-    Animator* getAnimatorSlot();
-
-};
-
-
 
 #endif
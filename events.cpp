@@ -0,0 +1,52 @@
+#include "events.h"
+
+
+EventQueue::EventQueue(int capacity) : events(capacity > 0 ? capacity : 1) {
+    bulkCapacity = events.size() * 3 / 4;
+    for (int type = 0; type < EVENT_TYPE_COUNT; type++)
+        dropped[type] = 0;
+}
+
+bool EventQueue::post(EventType type, int64_t value) {
+    if (handlers[type].empty())
+        return true; // nobody listens
+    int capacity = events.size();
+    if (count >= (type == EVENT_ANIMATION_DONE ? bulkCapacity : capacity)) {
+        dropped[type] ++;
+        return false;
+    }
+    Event& event = events[(head + count) % capacity];
+    event.type = type;
+    event.value = value;
+    count ++;
+    return true;
+}
+
+void EventQueue::subscribe(EventType type, EventHandler* handler) {
+    handlers[type].push_back(handler);
+}
+
+void EventQueue::drain() {
+    int capacity = events.size();
+    int pending = count;
+    for (int k=0; k < pending; k++) {
+        Event event = events[head]; // a copy, handlers may post over the slot once it is free
+        head = (head + 1) % capacity;
+        count --;
+        std::vector<EventHandler*>& subscribed = handlers[event.type];
+        for (int h=0; h < (int) subscribed.size(); h++)
+            subscribed[h]->handle(event.type, event.value);
+    }
+}
+
+long EventQueue::getDropped() {
+    long all = 0;
+    for (int type = 0; type < EVENT_TYPE_COUNT; type++)
+        all += dropped[type];
+    return all;
+}
+
+void EventQueue::clear() {
+    head = 0;
+    count = 0;
+}
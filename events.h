@@ -0,0 +1,64 @@
+#ifndef EVENTS_H
+#define EVENTS_H
+
+// Game events. No SDL in here.
+
+#include <stdint.h>
+#include <vector>
+
+// What the value posted along with each type means
+enum EventType {
+    EVENT_ANIMATION_DONE, // the sprite whose animation finished, as a pointer. Not posted for cancelled ones.
+    EVENT_COLUMN_SETTLED, // map column whose boxes landed, after a fall or a new column coming in
+    EVENT_CLUSTER_DISCARDED, // number of boxes discarded by a click
+    EVENT_GAME_OVER, // nothing
+    EVENT_MOUSE_PRESSED, // left button, screen position. See packXY().
+    EVENT_MOUSE_RELEASED, // left button, screen position
+    EVENT_TYPE_COUNT
+};
+
+inline int64_t packXY(int x, int y) { return ((int64_t) x << 32) | (uint32_t) y; }
+inline int unpackX(int64_t value) { return (int) (value >> 32); }
+inline int unpackY(int64_t value) { return (int) (uint32_t) value; }
+
+class EventHandler {
+public:
+    virtual ~EventHandler() {}
+    virtual void handle(EventType type, int64_t value) = 0;
+};
+
+// Fixed capacity ring of events. Anyone holding the queue posts to it, the main loop drains it once per frame and
+// every event goes to the handlers subscribed to its type, in the order posted. Nothing is allocated after the
+// handlers are subscribed. Events of a type nobody subscribed to are not queued at all.
+//
+// EVENT_ANIMATION_DONE comes in bursts, one per sprite, and may only fill 'bulkCapacity' of the ring. The rest is kept
+// for the events the game relies on, like EVENT_COLUMN_SETTLED and EVENT_GAME_OVER. When there is no room new events
+// are dropped and counted.
+class EventQueue {
+private:
+    struct Event {
+        EventType type;
+        int64_t value;
+    };
+
+    std::vector<Event> events;
+    int head = 0; // oldest event
+    int count = 0;
+    int bulkCapacity;
+    long dropped[EVENT_TYPE_COUNT];
+    std::vector<EventHandler*> handlers[EVENT_TYPE_COUNT];
+
+public:
+    EventQueue(int capacity = 1024); // a quarter of it is kept for events other than EVENT_ANIMATION_DONE
+
+    bool post(EventType type, int64_t value = 0); // false if the queue is full
+    void subscribe(EventType type, EventHandler* handler); // not owned
+    void drain(); // events that handlers post wait for the next drain()
+    void clear();
+
+    inline int getCount() { return count; }
+    long getDropped(); // all types
+    inline long getDropped(EventType type) { return dropped[type]; }
+};
+
+#endif // EVENTS_H
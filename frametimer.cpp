@@ -0,0 +1,132 @@
+#include "frametimer.h"
+#include "utils.h"
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+extern LogStream<LOG_ERROR> errorLog;
+extern LogStream<LOG_WARNING> warningLog;
+
+const char* FrameTimer::phaseNames[PHASE_COUNT] = {
+    "input", "events", "gravity1", "gravity2", "condense", "animate", "render", "present", "frame"
+};
+
+
+FrameTimer::FrameTimer(int window) : window(window > 0 ? window : 1) {
+    history = new float[this->window * PHASE_COUNT];
+    memset(buckets, 0, sizeof(buckets));
+    memset(current, 0, sizeof(current));
+    memset(phaseStart, 0, sizeof(phaseStart));
+}
+
+FrameTimer::~FrameTimer() {
+    delete [] history;
+}
+
+int64_t FrameTimer::now() {
+    return Tracer::now();
+}
+
+int FrameTimer::bucketOf(float micros) {
+    if (micros < 1)
+        return 0;
+    int bucket = (int) (log2f(micros) * 4) + 1;
+    return bucket < BUCKET_COUNT ? bucket : BUCKET_COUNT-1;
+}
+
+float FrameTimer::bucketLimit(int bucket) {
+    return exp2f(bucket / 4.0f);
+}
+
+void FrameTimer::logFrames(int maxFrames) {
+    maxLoggedFrames = maxFrames;
+    frames.reserve(PHASE_COUNT * (maxFrames < 3600 ? maxFrames : 3600)); // a minute at 60fps, grows after that
+}
+
+void FrameTimer::beginFrame() {
+    memset(current, 0, sizeof(current));
+    frameStart = now();
+}
+
+void FrameTimer::endFrame() {
+    int64_t ended = now();
+    current[PHASE_FRAME] = (ended - frameStart) * 0.001f;
+    if (tracer.isEnabled())
+        tracer.complete(phaseNames[PHASE_FRAME], frameStart, ended);
+
+    float* slot = history + historyNext * PHASE_COUNT;
+    for (int phase = 0; phase < PHASE_COUNT; phase++) {
+        if (historyCount == window)
+            buckets[phase][bucketOf(slot[phase])] --; // forget the oldest frame
+        slot[phase] = current[phase];
+        buckets[phase][bucketOf(current[phase])] ++;
+    }
+    historyNext = (historyNext + 1) % window;
+    if (historyCount < window)
+        historyCount ++;
+
+    if (maxLoggedFrames) {
+        if ((int) frames.size() < maxLoggedFrames * PHASE_COUNT)
+            frames.insert(frames.end(), current, current + PHASE_COUNT);
+        else
+            droppedFrames ++;
+    }
+}
+
+float FrameTimer::percentile(FramePhase phase, float p) const {
+    if (!historyCount)
+        return 0;
+    int target = (int) ceilf(p * historyCount);
+    if (target < 1)
+        target = 1;
+    int seen = 0;
+    for (int bucket = 0; bucket < BUCKET_COUNT; bucket++) {
+        seen += buckets[phase][bucket];
+        if (seen >= target) {
+            float limit = bucketLimit(bucket);
+            float maxMicros = max(phase);
+            return limit < maxMicros ? limit : maxMicros;
+        }
+    }
+    return max(phase);
+}
+
+float FrameTimer::max(FramePhase phase) const {
+    float result = 0;
+    for (int k = 0; k < historyCount; k++)
+        if (history[k * PHASE_COUNT + phase] > result)
+            result = history[k * PHASE_COUNT + phase];
+    return result;
+}
+
+float FrameTimer::last(FramePhase phase) const {
+    if (!historyCount)
+        return 0;
+    int k = (historyNext + window - 1) % window;
+    return history[k * PHASE_COUNT + phase];
+}
+
+bool FrameTimer::writeCsv(const char* filename) const {
+    FILE* file = fopen(filename, "w");
+    if (!file) {
+        errorLog << "could not write frame times to " << filename << "\n";
+        return false;
+    }
+    fprintf(file, "frame");
+    for (int phase = 0; phase < PHASE_COUNT; phase++)
+        fprintf(file, ",%s_us", phaseNames[phase]);
+    fprintf(file, "\n");
+
+    int frameCount = frames.size() / PHASE_COUNT;
+    for (int frame = 0; frame < frameCount; frame++) {
+        fprintf(file, "%d", frame);
+        for (int phase = 0; phase < PHASE_COUNT; phase++)
+            fprintf(file, ",%.1f", frames[frame * PHASE_COUNT + phase]);
+        fprintf(file, "\n");
+    }
+    fclose(file);
+
+    if (droppedFrames)
+        warningLog << droppedFrames << " frames were not logged\n";
+    return true;
+}
@@ -0,0 +1,90 @@
+#ifndef FRAMETIMER_H
+#define FRAMETIMER_H
+
+// Per-phase frame timing. No SDL in here, the overlay that draws it lives in engine.h.
+
+#include <stdint.h>
+#include <vector>
+#include "trace.h"
+
+// phases of the main loop in sdl-game.cpp. Simulation phases may run several times per frame (fixed ticks) and
+// their times add up.
+enum FramePhase {
+    PHASE_INPUT,
+    PHASE_EVENTS,
+    PHASE_GRAVITY1,
+    PHASE_GRAVITY2,
+    PHASE_CONDENSE,
+    PHASE_ANIMATE,
+    PHASE_RENDER,
+    PHASE_PRESENT,
+    PHASE_FRAME, // the whole frame, begin to end
+    PHASE_COUNT
+};
+
+
+// Measures each phase every frame with the steady (high resolution) clock. Keeps a histogram per phase over the last
+// 'window' frames for percentiles and, optionally, every frame for a CSV dump.
+// Usage: beginFrame(), begin(phase)/end(phase) pairs, endFrame(). Phases and frames also go to the tracer when it is on.
+class FrameTimer {
+public:
+    static const char* phaseNames[PHASE_COUNT];
+
+    // histogram buckets are a quarter of an octave wide starting at 1us. The last one collects everything above ~16s.
+    static const int BUCKET_COUNT = 96;
+
+private:
+    int window; // frames kept for percentiles
+    int64_t frameStart = 0;
+    int64_t phaseStart[PHASE_COUNT];
+    float current[PHASE_COUNT]; // micros spent in each phase during the current frame
+
+    float* history; // last 'window' frames. window x PHASE_COUNT, oldest overwritten first.
+    int historyNext = 0;
+    int historyCount = 0;
+    int buckets[PHASE_COUNT][BUCKET_COUNT]; // histogram of 'history'
+
+    std::vector<float> frames; // every frame since start, PHASE_COUNT values each. Only when logging.
+    int maxLoggedFrames = 0;
+    int droppedFrames = 0;
+
+    static int64_t now(); // nanos
+    static int bucketOf(float micros);
+    static float bucketLimit(int bucket); // upper limit in micros
+
+public:
+    FrameTimer(int window = 600);
+    ~FrameTimer();
+
+    FrameTimer(const FrameTimer&) = delete;
+    FrameTimer& operator=(const FrameTimer&) = delete;
+
+    // keep every frame so that writeCsv() can dump it. Stops after 'maxFrames'.
+    void logFrames(int maxFrames = 1 << 20);
+
+    void beginFrame();
+    void endFrame();
+
+    inline void begin(FramePhase phase) {
+        phaseStart[phase] = now();
+    }
+
+    inline void end(FramePhase phase) {
+        int64_t ended = now();
+        current[phase] += (ended - phaseStart[phase]) * 0.001f;
+        if (tracer.isEnabled())
+            tracer.complete(phaseNames[phase], phaseStart[phase], ended);
+    }
+
+    int frameCount() const { return historyCount; } // within the window
+
+    // over the window, in micros. Percentiles are approximated by histogram bucket limits.
+    float percentile(FramePhase phase, float p) const;
+    float max(FramePhase phase) const;
+    float last(FramePhase phase) const; // the last finished frame
+
+    // one line per logged frame, one column per phase, micros
+    bool writeCsv(const char* filename) const;
+};
+
+#endif // FRAMETIMER_H
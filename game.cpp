@@ -1,81 +1,222 @@
 #include "game.h"
 #include "utils.h"
+#include "trace.h"
 
 // external linkage
-extern LogStream warningLog; 
-extern LogStream errorLog;
-extern LogStream infoLog;
-
-template class ListPool<Animator,int>; // instansiate class out of class template
+extern LogStream<LOG_WARNING> warningLog; 
+extern LogStream<LOG_ERROR> errorLog;
+extern LogStream<LOG_INFO> infoLog;
 
 BoxSprite* BoxMap::OUT_OF_LIMITS = 0; // definition for static field of BoxMap class. Needed when linking.
+BoxSprite* BoxMap::NO_BOX = 0;
 
-void BoxMap::renderBoxes(Engine* engine) {
-    for (int i=0; i < width; i++) {
-        for (int j=0; j<height; j++) {
-            Sprite* sprite = boxes[ width*j + i ];
-            if (sprite) {
-                sprite->render(engine);
-            }
-        }
-    }
+void BoxMap::initBitboards() {
+    int bits = width*height;
+    occupied.resize(bits);
+    for (int c = RED_BOX; c <= GREEN_BOX; c++)
+        colors[c].resize(bits);
+    visited.resize(bits);
+    changed.resize(bits);
+    dirtyColumns.resize(width);
+    toggledColumns.resize(width);
 }
 
 void BoxMap::putBox(int posX, int posY, BoxSprite* boxSprite) {
-    // TODO - what if boxSprite == 0
-    if ( boxes[posY*width + posX] ) {
+    if (!boxSprite) {
+        warningLog << "BoxMap: no box to put at (" << posX << "," << posY << ")\n";
+    } else
+    if ( at(posX, posY) ) {
         warningLog << "BoxMap: there is already a box position (" << posX << "," << posY << ")\n";
     } else {
-        boxes[posY*width + posX] = boxSprite;
+        BoxChunk*& chunk = chunks[(posX / BoxChunk::SIZE)*chunkRows + posY / BoxChunk::SIZE];
+        if (!chunk)
+            chunk = chunkPool.create();
+        chunk->boxes[chunkSlot(posX, posY)] = boxSprite;
+        chunk->count ++;
+        if (columnBoxes[posX]++ == 0)
+            toggledColumns.add(posX);
+        dirtyColumns.add(posX);
+        int bit = bitIndex(posX, posY);
+        occupied.set(bit);
+        colors[boxSprite->boxId].set(bit);
+        touch(bit);
     }
 }
 
+BoxSprite* BoxMap::takeBox(int posX, int posY) {
+    BoxChunk*& chunk = chunks[(posX / BoxChunk::SIZE)*chunkRows + posY / BoxChunk::SIZE];
+    BoxSprite* boxSprite = chunk ? chunk->boxes[chunkSlot(posX, posY)] : 0;
+    if (boxSprite) {
+        chunk->boxes[chunkSlot(posX, posY)] = 0;
+        if (--columnBoxes[posX] == 0)
+            toggledColumns.add(posX);
+        dirtyColumns.add(posX);
+        if (--chunk->count == 0) {
+            chunkPool.destroy(chunk);
+            chunk = 0;
+        }
+        int bit = bitIndex(posX, posY);
+        occupied.clear(bit);
+        colors[boxSprite->boxId].clear(bit);
+        touch(bit);
+    }
+    return boxSprite;
+}
+
+void BoxMap::moveBox(int fromX, int fromY, int toX, int toY) {
+    BoxSprite* boxSprite = takeBox(fromX, fromY);
+    if (boxSprite)
+        putBox(toX, toY, boxSprite);
+}
+
 // returns a reference to the box item at position (tilex,tiley) 
-BoxSprite*& BoxMap::at(int tilex, int tiley) {
+BoxSprite* const& BoxMap::at(int tilex, int tiley) {
     if (tilex < 0 || tilex >= width || tiley < 0 || tiley >=height)
         return BoxMap::OUT_OF_LIMITS;
-    
-    return boxes[width*tiley+tilex];
+
+    BoxChunk* chunk = chunkOf(tilex, tiley);
+    if (!chunk)
+        return BoxMap::NO_BOX;
+    return chunk->boxes[chunkSlot(tilex, tiley)];
+}
+
+// boxes in a settled column are stacked at the bottom with no gaps, i.e. the last 'count' bits of the column are set
+bool BoxMap::columnSettled(int i) {
+    int count = columnBoxes[i];
+    return occupied.countRange(bitIndex(i,height-count), count) == count;
+}
+
+// Scanline flood fill. Columns are contiguous in the bitboards so the scanlines run vertically: a seed is grown to the
+// whole same-colored run of its column and the runs of the neighbouring columns that touch it become new seeds.
+// Every tile is visited once. No recursion, so a big single-colored region can't blow the stack.
+int BoxMap::floodCluster(int tilex, int tiley, std::vector<TilePos>& tiles) {
+    tiles.clear();
+    BoxSprite* seed = at(tilex, tiley);
+    if (!seed)
+        return 0; // empty tile or tile out of map bounds
+
+    Bitboard& color = colors[seed->boxId];
+    seeds.clear();
+    seeds.push_back(bitIndex(tilex, tiley));
+    while (!seeds.empty()) {
+        int bit = seeds.back();
+        seeds.pop_back();
+        if (visited.test(bit))
+            continue; // the run has already been walked through from another seed
+
+        int i = bit / height;
+        int columnTop = bitIndex(i, 0);
+        int top = bit;
+        while (top > columnTop && color.test(top-1))
+            top--;
+        int bottom = bit;
+        while (bottom < columnTop+height-1 && color.test(bottom+1))
+            bottom++;
+
+        visited.setRange(top, bottom-top+1);
+        for (int b = top; b <= bottom; b++)
+            tiles.push_back(TilePos(i, b-columnTop));
+
+        // a new seed for every run in the left and right columns that is next to this one
+        for (int neighbour = i-1; neighbour <= i+1; neighbour += 2) {
+            if (neighbour < 0 || neighbour >= width)
+                continue;
+            int offset = (neighbour-i)*height;
+            bool inRun = false;
+            for (int b = top; b <= bottom; b++) {
+                bool same = color.test(b+offset);
+                if (same && !inRun && !visited.test(b+offset))
+                    seeds.push_back(b+offset);
+                inRun = same;
+            }
+        }
+    }
+
+    // leave the work area clean for the next time. Only touch what we set, so the cost stays with the cluster size.
+    for (size_t k=0; k < tiles.size(); k++)
+        visited.clear(bitIndex(tiles[k].x, tiles[k].y));
+
+    return tiles.size();
+}
+
+int BoxMap::clusterOf(int tilex, int tiley) {
+    if (!at(tilex, tiley))
+        return -1;
+    if (clusters.dirty())
+        clusters.refresh(this);
+    return chunkOf(tilex, tiley)->labels[chunkSlot(tilex, tiley)];
+}
+
+int BoxMap::clusterSize(int tilex, int tiley) {
+    int label = clusterOf(tilex, tiley);
+    if (label == -1)
+        return 0;
+    int labelx = label / height;
+    int labely = label % height;
+    return chunkOf(labelx, labely)->sizes[chunkSlot(labelx, labely)];
+}
+
+
+ClusterIndex::ClusterIndex(int tileCount) : touched(tileCount), relabeled(tileCount) {
+}
+
+// relabel every cluster that contains or borders a touched tile
+void ClusterIndex::refresh(BoxMap* boxMap) {
+    for (int k=0; k < touched.size(); k++) {
+        int bit = touched[k];
+        int tilex = bit / boxMap->height;
+        int tiley = bit % boxMap->height;
+        relabel(boxMap, tilex, tiley);
+        relabel(boxMap, tilex-1, tiley);
+        relabel(boxMap, tilex+1, tiley);
+        relabel(boxMap, tilex, tiley-1);
+        relabel(boxMap, tilex, tiley+1);
+    }
+    touched.clear();
+    relabeled.clear(); // leave the work area clean
+}
+
+// gives a fresh label to the cluster at (tilex,tiley) unless it already got one during this refresh
+void ClusterIndex::relabel(BoxMap* boxMap, int tilex, int tiley) {
+    if (!boxMap->at(tilex, tiley))
+        return; // empty tile or out of map bounds
+    if (relabeled.test(boxMap->bitIndex(tilex, tiley)))
+        return;
+
+    int count = boxMap->floodCluster(tilex, tiley, tiles);
+    int label = boxMap->bitIndex(tilex, tiley);
+    for (int k=0; k < count; k++) {
+        int bit = boxMap->bitIndex(tiles[k].x, tiles[k].y);
+        boxMap->chunkOf(tiles[k].x, tiles[k].y)->labels[BoxMap::chunkSlot(tiles[k].x, tiles[k].y)] = label;
+        relabeled.add(bit);
+    }
+    boxMap->chunkOf(tilex, tiley)->sizes[BoxMap::chunkSlot(tilex, tiley)] = count;
 }
 
  
-BoxSprite* BoxFactory::create(BoxId boxId) {
+BoxId BoxFactory::resolve(BoxId boxId) {
     if (boxId == BoxId::RANDOM_BOX) {
         boxId = (BoxId) randomInRange(RED_BOX, GREEN_BOX);
         //boxId = (BoxId) randomInRange(RED_BOX, ORANGE_BOX); // make it easier, use fewer colors
     }
-        
-    Texture* texture;
-    switch (boxId) {
-        case BoxId::RED_BOX:
-            texture = resources->getImage(ImageId::RED_BLOCK);
-        break;
-        case BoxId::BLUE_BOX:
-            texture = resources->getImage(ImageId::BLUE_BLOCK);
-        break;
-        case BoxId::ORANGE_BOX:
-            texture = resources->getImage(ImageId::ORANGE_BLOCK);
-        break;
-        case BoxId::GREY_BOX:
-            texture = resources->getImage(ImageId::GREY_BLOCK);
-        break;
-        case BoxId::BROWN_BOX:
-            texture = resources->getImage(ImageId::BROWN_BLOCK);
-        break;
-        case BoxId::GREEN_BOX:
-            texture = resources->getImage(ImageId::GREEN_BLOCK);
-        break;
-        default:
-            errorLog << "Can't create box. Invalid boxId: " << boxId << "\n";
-            return 0;
-        break;
+    return boxId;
+}
+
+BoxSprite* BoxFactory::create(BoxId boxId) {
+    boxId = resolve(boxId);
+    if (boxId < RED_BOX || boxId > GREEN_BOX) {
+        errorLog << "Can't create box. Invalid boxId: " << boxId << "\n";
+        return 0;
     }
-        
-    RenderableBitmap* renderable = new RenderableBitmap(texture, 64, 64); // texture mem handled by Resources
-    BoxSprite* boxSprite = new BoxSprite(renderable, boxId);
+
+    BoxSprite* boxSprite = boxPool.create((const Renderable*) 0, boxId);
     return boxSprite;
 }
 
+void BoxFactory::destroy(BoxSprite* boxSprite) {
+    boxPool.destroy(boxSprite);
+}
+
 // world position from tile coordinates
 Point2 Game::posAt(int tilex, int tiley) {
     Point2 atpos;
@@ -89,8 +230,12 @@ Point2 Game::posAt(int tilex, int tiley) {
 // return false if out of boxMap limits
 bool Game::tileXYAt(int screenx, int screeny, int& tilex, int& tiley) {
     // express in world coordinates
-    int x = screenx + engine->camera->worldPos.x;
-    int y = screeny + engine->camera->worldPos.y;
+    int x = screenx;
+    int y = screeny;
+    if (camera) {
+        x += camera->worldPos.x;
+        y += camera->worldPos.y;
+    }
     x -= mapPos.x; // make relative to boxmap
     y -= mapPos.y;
 
@@ -120,60 +265,64 @@ BoxSprite* Game::newBoxAt(int mapX, int mapY, BoxId boxId) {
 
 // moves a block of boxes to the left
 MoveStatus Game::moveBlockLeft(int top, int left, int pastBottom, int pastRight) {
+    Bitboard& occupied = boxMap->occupied;
     for (int i = left; i < pastRight; i++) {
-        for (int j=top; j< pastBottom; j++) {
-            BoxSprite*& srcMapPos = boxMap->at(i, j);
-            if ( srcMapPos ) {
-                BoxSprite* movedSprite = srcMapPos;
-                if (i > 0) { // make sure we didn't reach the left border
-                    BoxSprite*& destMapPos = boxMap->at(i-1,j);
-                    if (destMapPos) {
-                        errorLog << "Cannot move to the left. Tile already occupied: (" << i-1 << "," << j << ")\n";
-                        return MoveStatus::ALREADY_OCCUPIED;
-                    } else {
-                        destMapPos = srcMapPos;
-                        srcMapPos = 0;
-                        // set up animation
-                        Animator* animator = engine->animations->getAnimatorSlot();
-                        Point2 targetPos = posAt(i-1,j);
-                        animator->set(movedSprite, targetPos,30);
-                    }
-                
+        int pastBit = boxMap->bitIndex(i, pastBottom);
+        for (int bit = occupied.next(boxMap->bitIndex(i, top)); bit != -1 && bit < pastBit; bit = occupied.next(bit+1)) {
+            int j = bit - boxMap->bitIndex(i, 0);
+            BoxSprite* movedSprite = boxMap->at(i, j);
+            if (i > 0) { // make sure we didn't reach the left border
+                if (boxMap->at(i-1,j)) {
+                    errorLog << "Cannot move to the left. Tile already occupied: (" << i-1 << "," << j << ")\n";
+                    return MoveStatus::ALREADY_OCCUPIED;
                 } else {
-                    return MoveStatus::PAST_LEFT_LIMITS;
+                    boxMap->moveBox(i, j, i-1, j);
+                    // set up animation
+                    Animator* animator = animations->getAnimatorSlot();
+                    Point2 targetPos = posAt(i-1,j);
+                    animator->set(movedSprite, targetPos, SHIFT_MILLIS);
                 }
+            
+            } else {
+                return MoveStatus::PAST_LEFT_LIMITS;
             }
         }
+        if (i > 0) {
+            fallingUntil[i-1] = fallingUntil[i]; // the boxes take their landing time along
+            arrivingUntil[i-1] = arrivingUntil[i];
+        }
     }
     return MoveStatus::OK;
 }
 
 // moves a block of boxes to the left
 MoveStatus Game::moveBlockRight(int top, int left, int pastBottom, int pastRight) {
+    Bitboard& occupied = boxMap->occupied;
     for (int i = pastRight-1; i >= left; i--) {
-        for (int j=top; j< pastBottom; j++) {
-            BoxSprite*& srcMapPos = boxMap->at(i, j);
-            if ( srcMapPos ) {
-                BoxSprite* movedSprite = srcMapPos;
-                if (i+1 < boxMap->width) { // make sure we didn't reach the right border
-                    BoxSprite*& destMapPos = boxMap->at(i+1,j);
-                    if (destMapPos) {
-                        errorLog << "Cannot move to the right. Tile already occupied: (" << i+1 << "," << j << ")\n";
-                        return MoveStatus::ALREADY_OCCUPIED;
-                    } else {
-                        destMapPos = srcMapPos;
-                        srcMapPos = 0;
-                        // set up animation
-                        Animator* animator = engine->animations->getAnimatorSlot();
-                        Point2 targetPos = posAt(i+1,j);
-                        animator->set(movedSprite, targetPos,30);
-                    }
-                
+        int pastBit = boxMap->bitIndex(i, pastBottom);
+        for (int bit = occupied.next(boxMap->bitIndex(i, top)); bit != -1 && bit < pastBit; bit = occupied.next(bit+1)) {
+            int j = bit - boxMap->bitIndex(i, 0);
+            BoxSprite* movedSprite = boxMap->at(i, j);
+            if (i+1 < boxMap->width) { // make sure we didn't reach the right border
+                if (boxMap->at(i+1,j)) {
+                    errorLog << "Cannot move to the right. Tile already occupied: (" << i+1 << "," << j << ")\n";
+                    return MoveStatus::ALREADY_OCCUPIED;
                 } else {
-                    return MoveStatus::PAST_RIGHT_LIMITS;
+                    boxMap->moveBox(i, j, i+1, j);
+                    // set up animation
+                    Animator* animator = animations->getAnimatorSlot();
+                    Point2 targetPos = posAt(i+1,j);
+                    animator->set(movedSprite, targetPos, SHIFT_MILLIS);
                 }
+            
+            } else {
+                return MoveStatus::PAST_RIGHT_LIMITS;
             }
         }
+        if (i+1 < boxMap->width) {
+            fallingUntil[i+1] = fallingUntil[i];
+            arrivingUntil[i+1] = arrivingUntil[i];
+        }
     }
     return MoveStatus::OK;
 }
@@ -182,43 +331,51 @@ MoveStatus Game::moveColumnRight(int i, int posCount) {
     if ( i+posCount >= boxMap->width)
         return MoveStatus::PAST_RIGHT_LIMITS;
         
-    for (int j=0; j<boxMap->height; j++) {
-        BoxSprite*& srcMapPos = boxMap->at(i, j);
-        BoxSprite*& destMapPos = boxMap->at(i+posCount, j);
-        if (srcMapPos) {
-            BoxSprite* movedSprite = srcMapPos;
-            if (destMapPos) {
-                errorLog << "Cannot move column to the right. Tile already occupied: (" << i+posCount << "," << j << ")\n";
-                return MoveStatus::ALREADY_OCCUPIED;
-            } else {
-                destMapPos = srcMapPos;
-                srcMapPos = 0;
-                // set up animation
-                Animator* animator = engine->animations->getAnimatorSlot();
-                Point2 targetPos = posAt(i+posCount, j);
-                animator->set(movedSprite, targetPos,30);            
-            }
+    Bitboard& occupied = boxMap->occupied;
+    int pastBit = boxMap->bitIndex(i+1, 0);
+    for (int bit = occupied.next(boxMap->bitIndex(i, 0)); bit != -1 && bit < pastBit; bit = occupied.next(bit+1)) {
+        int j = bit - boxMap->bitIndex(i, 0);
+        BoxSprite* movedSprite = boxMap->at(i, j);
+        if (boxMap->at(i+posCount, j)) {
+            errorLog << "Cannot move column to the right. Tile already occupied: (" << i+posCount << "," << j << ")\n";
+            return MoveStatus::ALREADY_OCCUPIED;
+        } else {
+            boxMap->moveBox(i, j, i+posCount, j);
+            // set up animation
+            Animator* animator = animations->getAnimatorSlot();
+            Point2 targetPos = posAt(i+posCount, j);
+            animator->set(movedSprite, targetPos, SHIFT_MILLIS);            
         }
     }
+    fallingUntil[i+posCount] = fallingUntil[i];
+    fallingUntil[i] = 0;
+    arrivingUntil[i+posCount] = arrivingUntil[i];
+    arrivingUntil[i] = 0;
     return MoveStatus::OK;
 }
 
 GameStatus Game::newColumn() {
+    TRACE_SCOPE("newColumn");
     MoveStatus status = moveBlockLeft(0,0,boxMap->height, boxMap->width);
     if (status == MoveStatus::OK) {
+        // settled once it has shifted in. Its boxes don't fall before that, see gravityEffect().
+        arrivingUntil[boxMap->width-1] = animations->time() + SHIFT_MILLIS;
+        fallingColumns ++;
         for (int j=0; j < boxMap->height; j++) {
             BoxSprite* boxSprite = boxFactory->create(BoxId::RANDOM_BOX);
             if (boxSprite) {
                 boxSprite->setPos( posAt(boxMap->width, j) );
                 boxMap->putBox(boxMap->width-1, j, boxSprite);
-                Animator* animator = engine->animations->getAnimatorSlot();
+                Animator* animator = animations->getAnimatorSlot();
                 Point2 targetPos = posAt(boxMap->width-1,j);
-                animator->set(boxSprite, targetPos,30);
+                animator->set(boxSprite, targetPos, SHIFT_MILLIS);
             }            
         }
         return GameStatus::GAME_OK;
     } else 
     if (status == MoveStatus::PAST_LEFT_LIMITS) {
+        if (events)
+            events->post(EVENT_GAME_OVER);
         return GameStatus::GAME_OVER;
     }
 
@@ -226,95 +383,121 @@ GameStatus Game::newColumn() {
 }
 
 // clicked box are discarded using this function
-// references BoxMap sprite location
-void Game::discardBox(BoxSprite*& discardedSprite) {
-    delete discardedSprite;
-    discardedSprite = 0;
+void Game::discardBox(int tilex, int tiley) {
+    BoxSprite* discardedSprite = boxMap->takeBox(tilex, tiley);
+    animations->cancel(discardedSprite); // may still be falling or shifting
+    boxFactory->destroy(discardedSprite);
     // TODO start an animation to make sprite disappear
 }
 
-// searches recursively for boxes with the same color as one at (tilex,tiley)
-void Game::discardSameColor(int tilex, int tiley, int& discardedCount, BoxId prevBoxId) {
-    BoxSprite*& currentBox = boxMap->at(tilex, tiley);
-    
-    if (currentBox == 0 || &currentBox == &BoxMap::OUT_OF_LIMITS) {
-        return; // empty tile or tile out of map bounds
-    } else {
-        BoxId currentBoxId = currentBox->boxId;
-        if (currentBoxId == prevBoxId) {
-            discardBox(currentBox);
-            discardedCount ++;
-        }
-        if (currentBoxId == prevBoxId || prevBoxId == UNDEFINED_BOX) {
-            discardSameColor(tilex-1, tiley, discardedCount, currentBoxId);
-            discardSameColor(tilex, tiley-1, discardedCount, currentBoxId);
-            discardSameColor(tilex+1, tiley, discardedCount, currentBoxId);
-            discardSameColor(tilex, tiley+1, discardedCount, currentBoxId);
-        }
+// discards the boxes with the same color as the one at (tilex,tiley) that are connected to it, as long as there are
+// at least 'minClusterSize' of them.
+// The discarded tiles are left in 'discardedTiles'.
+void Game::discardSameColor(int tilex, int tiley, int& discardedCount) {
+    TRACE_SCOPE("discardSameColor");
+    if (boxMap->floodCluster(tilex, tiley, discardedTiles) < minClusterSize) {
+        discardedTiles.clear();
+        return; // empty tile, tile out of map bounds or too few same-colored neighbours
     }
+
+    for (size_t k=0; k < discardedTiles.size(); k++)
+        discardBox(discardedTiles[k].x, discardedTiles[k].y);
+    discardedCount += discardedTiles.size();
+    if (events)
+        events->post(EVENT_CLUSTER_DISCARDED, discardedTiles.size());
 }
 
 // makes unsupported boxes fall and creates animations for them
 // returns number of boxes that fell
+//
+// Only the columns the map reports as changed are looked at. A column whose boxes are still falling is left alone
+// and stays dirty until they land, then it is scanned again (see "Πτώσεις" in docs/devtips.md).
+// A new column is left alone the same way until it has shifted in.
 int Game::gravityEffect() {
+    TRACE_SCOPE("gravityEffect");
     int movedCount = 0;
-    for (int i=0; i < boxMap->width; i++) {
-        
-        int countEmpty = 0;
-        int j = boxMap->height-1;
-        BoxSprite* boxSprite = 0;
-        boxSprite = boxMap->at(i,j);
-        //  walk until empty sprite
-        while ( j>= 0 && boxSprite ) {
-            j--;
-            boxSprite = boxMap->at(i,j);
+    float now = animations->time();
+    if (fallingColumns) {
+        fallingColumns = 0;
+        for (int i=0; i < boxMap->width; i++) {
+            if (!fallingUntil[i] && !arrivingUntil[i])
+                continue;
+            if (fallingUntil[i] > now || arrivingUntil[i] > now) {
+                fallingColumns ++;
+            } else {
+                fallingUntil[i] = 0;
+                arrivingUntil[i] = 0;
+                if (events)
+                    events->post(EVENT_COLUMN_SETTLED, i);
+            }
         }
-        // count empty tiles
-        while ( j >= 0 && !boxSprite) {
-            while ( j>=0 && !boxSprite ) {
-                countEmpty ++;
-                
-                j--;
-                boxSprite = boxMap->at(i,j);
-            }            
-            // first non-empty should fall
-            if (boxSprite) {
-                boxMap->at(i,j+countEmpty) = boxMap->at(i,j);
-                boxMap->at(i,j) = 0;
-                movedCount ++;
-                Animator* animator = engine->animations->getAnimatorSlot();
-                Point2 targetPos = posAt(i,j+countEmpty);
-                animator->set(boxSprite, targetPos,30);
+    }
 
-                boxSprite = 0; // we 'll keep searching for empty boxes upwards
-                countEmpty --;
-            }        
+    BitList& dirtyColumns = boxMap->dirtyColumns;
+    stillFalling.clear();
+    for (int k=0; k < dirtyColumns.size(); k++) {
+        int i = dirtyColumns[k];
+        if (fallingUntil[i] > now || arrivingUntil[i] > now) {
+            stillFalling.push_back(i); // or still shifting in
+            continue;
         }
-    }
-    return movedCount;
-}
+        if (boxMap->columnSettled(i))
+            continue; // nothing to fall here
 
-// assumes valid column index (i) value
-bool Game::columnEmpty(int i) {
-    for (int j=0; j<boxMap->height; j++) {
-        if (boxMap->at(i,j))
-            return false;
-            
+        // walk upwards from the bottom. Each box falls on the lowest free tile.
+        int landingJ = boxMap->height-1;
+        for (int j = boxMap->height-1; j >= 0; j--) {
+            if (!boxMap->occupied.test(boxMap->bitIndex(i,j)))
+                continue;
+            if (j != landingJ) {
+                BoxSprite* boxSprite = boxMap->at(i,j);
+                boxMap->moveBox(i, j, i, landingJ);
+                movedCount ++;
+                Animator* animator = animations->getAnimatorSlot();
+                Point2 targetPos = posAt(i,landingJ);
+                float millis = (landingJ-j)*FALL_MILLIS_PER_TILE;
+                animator->set(boxSprite, targetPos, millis, EASE_IN);
+                if (now + millis > fallingUntil[i]) {
+                    if (!fallingUntil[i])
+                        fallingColumns ++;
+                    fallingUntil[i] = now + millis;
+                }
+            }
+            landingJ --;
+        }
     }
-    return true;
+    dirtyColumns.clear(); // moving boxes above dirtied the same columns again, they are settled now
+    for (size_t k=0; k < stillFalling.size(); k++)
+        dirtyColumns.add(stillFalling[k]);
+    return movedCount;
 }
 
 // rightward condensing of column gaps
+//
+// A gap is an empty column with boxes somewhere on its left. One can only show up where a column emptied or to the
+// right of a column that got its first box, so the pass starts from the rightmost of those instead of the right edge,
+// and a tick where no column emptied or filled does nothing.
 GameStatus Game::condense() {
-    int i = boxMap->width-1; // starting from the right edge
+    TRACE_SCOPE("condense");
+    BitList& toggledColumns = boxMap->toggledColumns;
+    if (toggledColumns.empty())
+        return GameStatus::GAME_OK;
+    int i = -1;
+    for (int k=0; k < toggledColumns.size(); k++) {
+        int toggled = toggledColumns[k];
+        while (toggled+1 < boxMap->width && boxMap->columnEmpty(toggled+1))
+            toggled ++;
+        if (toggled > i)
+            i = toggled;
+    }
     
-    while ( i>=0 && !columnEmpty(i) ) {
+    while ( i>=0 && !boxMap->columnEmpty(i) ) {
         i--;
     }
     // count empty columns
     int countEmpty = 0;
     while (i >=0 ) {
-        while ( i>=0 && columnEmpty(i) ) {
+        while ( i>=0 && boxMap->columnEmpty(i) ) {
             countEmpty ++;
             i--;
         }
@@ -325,10 +508,15 @@ GameStatus Game::condense() {
             i --;
         }
     }
+    toggledColumns.clear(); // the columns emptied by the moves are all on the left now
     return GameStatus::GAME_OK;
 }
-    
-
-
-
 
+void Game::clear() {
+    animations->clear();
+    for (int bit = boxMap->occupied.next(0); bit != -1; bit = boxMap->occupied.next(bit+1))
+        discardBox(bit / boxMap->height, bit % boxMap->height);
+    fallingUntil.assign(boxMap->width, 0);
+    arrivingUntil.assign(boxMap->width, 0);
+    fallingColumns = 0;
+}
@@ -1,22 +1,17 @@
 #ifndef _GAME_H_
 #define _GAME_H_
 
-#include "engine.h"
+#include "sprite.h"
+#include "bitboard.h"
+#include "blockpool.h"
 #include <string.h>  // includes memset() for windows
+#include <stdint.h>
+#include <vector>
 
 #define BOX_TILE_WIDTH 64.0
 #define BOX_TILE_HEIGHT 64.0
-
-enum ImageId {
-    RED_BLOCK,
-    BLUE_BLOCK,
-    ORANGE_BLOCK,
-    GREY_BLOCK,
-    BROWN_BLOCK,
-    GREEN_BLOCK,   
-    
-     
-};
+#define SHIFT_MILLIS 500 // boxes moving sideways
+#define FALL_MILLIS_PER_TILE 120 // falls take longer the deeper they go
 
 enum BoxId {
     RED_BOX = 1, // need to number them in order to randomize
@@ -50,60 +45,169 @@ enum GameStatus {
 
 class BoxAnimator;
 class Sprite;
+class Engine;
 
 
 
 
+struct TilePos {
+    int x;
+    int y;
+
+    TilePos(int x, int y) : x(x), y(y) {}
+};
+
+
 // The fundamental gameplay unit. A colored brick in a wall with many others.
 class BoxSprite : public Sprite {
 public:
     BoxId boxId;
 
-    BoxSprite(Renderable* renderable, BoxId boxId) : Sprite(renderable), boxId(boxId) {}
+    BoxSprite(const Renderable* renderable, BoxId boxId) : Sprite(renderable), boxId(boxId) {}
 };
 
 
 
+struct BoxMap;
+
+// A SIZE x SIZE square of the map. BoxMap only allocates the chunks that hold boxes and gives them back when they
+// empty, so empty space costs a null pointer per chunk. Tiles are laid out column by column like the bitboards.
+struct BoxChunk {
+    static const int SIZE = 32;
+    static const int TILES = SIZE*SIZE;
+
+    BoxSprite* boxes[TILES];
+    int labels[TILES]; // see ClusterIndex. Only meaningful for occupied tiles.
+    int sizes[TILES]; // see ClusterIndex. Indexed like 'labels', for the tiles that a label points to.
+    int count = 0; // boxes in the chunk
+
+    BoxChunk() {
+        memset(boxes, 0, sizeof(boxes));
+    }
+};
+
+
+// Connected same-colored clusters of a BoxMap. Answers "which cluster is this tile in and how big is it" without
+// walking the map. BoxMap reports every tile it changes with touch(). A change can only split or merge the clusters
+// it touches or borders, so refresh() relabels just those, flood filling from the touched tiles and their neighbours.
+// The labels live in the map chunks (BoxChunk::labels). A label is the bit index of one of the cluster's tiles and
+// the cluster size is kept in BoxChunk::sizes at that tile.
+struct ClusterIndex {
+    BitList touched; // tiles changed since the last refresh()
+    BitList relabeled; // refresh() work area. All clear between calls.
+    std::vector<TilePos> tiles; // refresh() work area
+
+    ClusterIndex(int tileCount);
+
+    inline void touch(int bit) { touched.add(bit); }
+    inline bool dirty() { return !touched.empty(); }
+    void refresh(BoxMap* boxMap);
+    void relabel(BoxMap* boxMap, int tilex, int tiley);
+};
+
+
 // Core gameplay data structure. Defines a rectangular map with clickable colored boxes that fall, collapse and disappear under conditions
+//
+// Sprite pointers are kept in chunks (see BoxChunk) that exist only where there are boxes, so big sparse maps stay
+// cheap. Next to them the map keeps a bitboard per box color and one for occupancy. Bits are laid out column by
+// column (see bitIndex()) so a column is a contiguous run of bits and the rule passes can work on whole words.
+// Keep them in sync by changing the map only through putBox(), takeBox() and moveBox().
+//
+// The same functions count the boxes of every column and note the columns they change, so that the rule passes
+// that run every tick (Game::gravityEffect(), Game::condense()) look at those columns only.
 struct BoxMap {
     
     static BoxSprite* OUT_OF_LIMITS; // see Sprite*& at(int tilex, int tiley) below on how to use this
+    static BoxSprite* NO_BOX; // at() of a tile in a chunk that is not allocated
 
     int width; // number of boxes in x
     int height;  // number of boxes in y
-    
-    BoxSprite** boxes = 0; // BoxMap owns the sprites
 
-    BoxMap(int width, int height) : width(width), height(height) {        
-        boxes = new BoxSprite*[width*height];
-        memset(boxes, 0, width*height*sizeof(boxes[0])); // initialize
+    int chunkColumns; // chunks in x
+    int chunkRows; // chunks in y
+    BoxChunk** chunks = 0; // chunkColumns x chunkRows, column by column. Null where there are no boxes.
+    int* columnBoxes = 0; // boxes per column
+
+    Bitboard occupied;
+    Bitboard colors[GREEN_BOX+1]; // indexed by BoxId. Only RED_BOX..GREEN_BOX are used.
+    ClusterIndex clusters;
+    BitList changed; // tiles changed since the cached board image last redrew them. See BoardLayer in gameview.h
+    BitList dirtyColumns; // columns changed since Game::gravityEffect() last settled them
+    BitList toggledColumns; // columns that emptied or got their first box since the last Game::condense()
+
+    BoxMap(int width, int height) : width(width), height(height), clusters(width*height), chunkPool(8) {
+        chunkColumns = (width + BoxChunk::SIZE - 1) / BoxChunk::SIZE;
+        chunkRows = (height + BoxChunk::SIZE - 1) / BoxChunk::SIZE;
+        chunks = new BoxChunk*[chunkColumns*chunkRows];
+        memset(chunks, 0, chunkColumns*chunkRows*sizeof(chunks[0]));
+        columnBoxes = new int[width];
+        memset(columnBoxes, 0, width*sizeof(columnBoxes[0]));
+        initBitboards();
     }
     
     ~BoxMap() {
-        if (boxes) {
-            delete [] boxes;
-            boxes = 0;
-        }
+        delete [] chunks; // the chunks themselves go with chunkPool
+        delete [] columnBoxes;
     }
     
-    void renderBoxes(Engine* engine);
+    void renderBoxes(Engine* engine, const Point2& mapPos); // defined in gameview.cpp, along with the rest of the rendering
     void putBox(int posX, int posY, BoxSprite* boxSprite);    
+    BoxSprite* takeBox(int posX, int posY); // removes the box from the map and returns it. Ownership passes to the caller.
+    void moveBox(int fromX, int fromY, int toX, int toY); // destination should be empty
     inline int getWidth() { return width; }
     inline int getHeight() { return height; }
     
-    BoxSprite*& at(int tilex, int tiley);  // to check if tile out of map limits : if &boxMap->at(mapx, mapy) == &BoxMap::OUT_OF_LIMITS
+    BoxSprite* const& at(int tilex, int tiley);  // to check if tile out of map limits : if &boxMap->at(mapx, mapy) == &BoxMap::OUT_OF_LIMITS
+
+    inline int bitIndex(int tilex, int tiley) { return tilex*height + tiley; }
+
+    // chunks. Tile coordinates should be within the map.
+    inline BoxChunk* chunkOf(int tilex, int tiley) {
+        return chunks[(tilex / BoxChunk::SIZE)*chunkRows + tiley / BoxChunk::SIZE];
+    }
+    static inline int chunkSlot(int tilex, int tiley) {
+        return (tilex % BoxChunk::SIZE)*BoxChunk::SIZE + tiley % BoxChunk::SIZE;
+    }
+
+    inline bool columnEmpty(int i) { return !columnBoxes[i]; } // assumes valid column index
+
+    // bitboard queries
+    bool columnSettled(int i); // true if no box in column 'i' has an empty tile below it
+    int floodCluster(int tilex, int tiley, std::vector<TilePos>& tiles); // same-colored boxes connected to (tilex,tiley). Returns their number.
+
+    // cluster index queries. O(1) unless the map changed since the last query.
+    int clusterOf(int tilex, int tiley); // cluster label of the box at (tilex,tiley). -1 if there is no box.
+    int clusterSize(int tilex, int tiley); // number of same-colored boxes connected to the one at (tilex,tiley), itself included
+
+private:
+    BlockPool<BoxChunk> chunkPool;
+    Bitboard visited; // flood fill work area. All clear between calls.
+    std::vector<int> seeds; // flood fill work list, bit indices
+
+    void initBitboards();
+    inline void touch(int bit) {
+        clusters.touch(bit);
+        changed.add(bit);
+    }
     
 };
 
-// knows how to build boxes
+// knows how to build boxes. The base factory builds boxes with no renderable attached, which is all a headless
+// game needs. See BitmapBoxFactory in gameview.h for the one that can be drawn.
+// Boxes come from a pool owned by the factory. Size it for a full map plus the boxes in flight, e.g. a column being
+// fed, and steady play won't allocate. Boxes should be given back with destroy().
 class BoxFactory {
-private:
-    Resources* resources;
+protected:
+    BlockPool<BoxSprite> boxPool;
+
+    BoxId resolve(BoxId boxId); // picks a color for RANDOM_BOX
 
 public:
-    BoxFactory(Resources* resources) : resources(resources) {}
+    BoxFactory(int capacity) : boxPool(capacity) {}
+    virtual ~BoxFactory() {}
 
-    BoxSprite* create(BoxId boxId);
+    virtual BoxSprite* create(BoxId boxId);
+    void destroy(BoxSprite* boxSprite);
        
 };
 
@@ -111,22 +215,34 @@ public:
 // high level game api
 class Game {
 private:
-    void discardBox(BoxSprite*& discardedSprite);
-    bool columnEmpty(int i);
+    std::vector<int> stillFalling; // gravityEffect() work area
+    int fallingColumns = 0; // columns with a fallingUntil or arrivingUntil, give or take the ones moved sideways. None if 0.
+
+    void discardBox(int tilex, int tiley);
 
 public:
     Point2 mapPos; // position of the box map in world coordinates
-    Uint32 columnFeedPeriod = 5000; // in millisec
+    uint32_t columnFeedPeriod = 5000; // in millisec
 
-    Engine* engine;
+    Animations* animations; // not owned
+    Camera* camera; // not owned. Used to translate screen coordinates. May be null when running headless.
+    EventQueue* events = 0; // not owned. Columns settling, discarded clusters and game over are posted here when set.
     BoxMap* boxMap;
     BoxFactory* boxFactory;
+    std::vector<TilePos> discardedTiles; // boxes removed by the last discardSameColor()
+    int minClusterSize = 3; // clicking a smaller cluster discards nothing. See "Διαγραφή κομματιού" in docs/devtips.md
+    std::vector<float> fallingUntil; // per column, when the boxes falling in it land. Animations::time() millis, 0 once landed.
+    std::vector<float> arrivingUntil; // per column, when a column fed into it has shifted in. 0 once in.
         
-    Game(BoxMap* boxMap, BoxFactory* boxFactory, Engine* engine) :
+    Game(BoxMap* boxMap, BoxFactory* boxFactory, Animations* animations, Camera* camera = 0) :
+        animations(animations),
+        camera(camera),
         boxMap(boxMap),
-        boxFactory(boxFactory),
-        engine(engine)
-    {}
+        boxFactory(boxFactory)
+    {
+        fallingUntil.assign(boxMap->width, 0);
+        arrivingUntil.assign(boxMap->width, 0);
+    }
 
     ~Game() {}
     
@@ -139,9 +255,10 @@ public:
     MoveStatus moveBlockRight(int top, int left, int pastBottom, int pastRight);
     MoveStatus moveColumnRight(int i, int posCount);
     GameStatus newColumn(); // a new column is added periodically to the right and all boxes are moved to the left
-    void discardSameColor(int tilex, int tiley, int& discardedCount, BoxId prevBoxId = UNDEFINED_BOX);
-    int gravityEffect();
+    void discardSameColor(int tilex, int tiley, int& discardedCount);
+    int gravityEffect(); // also reports the columns that landed since the last call
     GameStatus condense();
+    void clear(); // discard all boxes and animations. Start over.
 
 };
 
@@ -0,0 +1,200 @@
+#include "gameview.h"
+#include "utils.h"
+#include <math.h>
+
+// external linkage
+extern LogStream<LOG_ERROR> errorLog;
+
+
+// Only the tiles in view are visited, plus one tile around them for boxes still on their way from a neighbouring tile,
+// so the cost follows the size of the viewport and not that of the map. A box falling from further away shows up once
+// its destination tile is in range. Boxes are queued to the engine's batch and drawn together, one draw call per texture.
+void BoxMap::renderBoxes(Engine* engine, const Point2& mapPos) {
+    // the visible part of the world, relative to the top left corner of the map
+    const Point2& clipPos = engine->clipping->getPos();
+    float left = engine->camera->worldPos.x + clipPos.x - mapPos.x;
+    float top = engine->camera->worldPos.y + clipPos.y - mapPos.y;
+    int firstI = (int) floorf(left / BOX_TILE_WIDTH) - 1;
+    int lastI = (int) floorf((left + engine->clipping->getWidth()) / BOX_TILE_WIDTH) + 1;
+    int firstJ = (int) floorf(top / BOX_TILE_HEIGHT) - 1;
+    int lastJ = (int) floorf((top + engine->clipping->getHeight()) / BOX_TILE_HEIGHT) + 1;
+    if (firstI < 0) firstI = 0;
+    if (firstJ < 0) firstJ = 0;
+    if (lastI > width-1) lastI = width-1;
+    if (lastJ > height-1) lastJ = height-1;
+
+    // walk the range chunk by chunk, skipping the ones with no boxes
+    for (int ci = firstI / BoxChunk::SIZE; firstI <= lastI && ci <= lastI / BoxChunk::SIZE; ci++) {
+        int fromI = ci*BoxChunk::SIZE > firstI ? ci*BoxChunk::SIZE : firstI;
+        int toI = ci*BoxChunk::SIZE + BoxChunk::SIZE-1 < lastI ? ci*BoxChunk::SIZE + BoxChunk::SIZE-1 : lastI;
+        for (int cj = firstJ / BoxChunk::SIZE; firstJ <= lastJ && cj <= lastJ / BoxChunk::SIZE; cj++) {
+            BoxChunk* chunk = chunks[ci*chunkRows + cj];
+            if (!chunk)
+                continue; // no boxes there
+            int fromJ = cj*BoxChunk::SIZE > firstJ ? cj*BoxChunk::SIZE : firstJ;
+            int toJ = cj*BoxChunk::SIZE + BoxChunk::SIZE-1 < lastJ ? cj*BoxChunk::SIZE + BoxChunk::SIZE-1 : lastJ;
+            for (int i = fromI; i <= toI; i++) {
+                for (int j = fromJ; j <= toJ; j++) {
+                    Sprite* sprite = chunk->boxes[chunkSlot(i, j)];
+                    if (sprite) {
+                        sprite->render(engine);
+                    }
+                }
+            }
+        }
+    }
+    if (engine->batching)
+        engine->batch.flush(engine->renderer);
+}
+
+BitmapBoxFactory::BitmapBoxFactory(Resources* resources, int capacity) : BoxFactory(capacity), resources(resources) {
+    static const ImageId images[GREEN_BOX+1] = {
+        RED_BLOCK, // unused
+        RED_BLOCK, // RED_BOX
+        BLUE_BLOCK, // BLUE_BOX
+        ORANGE_BLOCK, // ORANGE_BOX
+        GREY_BLOCK, // GREY_BOX
+        BROWN_BLOCK, // BROWN_BOX
+        GREEN_BLOCK // GREEN_BOX
+    };
+    for (int boxId = RED_BOX; boxId <= GREEN_BOX; boxId++)
+        renderables[boxId] = new RenderableBitmap(resources, resources->acquireImage(images[boxId]), 64, 64);
+}
+
+BitmapBoxFactory::~BitmapBoxFactory() {
+    for (int boxId = RED_BOX; boxId <= GREEN_BOX; boxId++)
+        delete renderables[boxId];
+}
+
+BoxSprite* BitmapBoxFactory::create(BoxId boxId) {
+    BoxSprite* boxSprite = BoxFactory::create(boxId);
+    if (boxSprite)
+        boxSprite->renderable = renderables[boxSprite->boxId];
+    return boxSprite;
+}
+
+
+BoardLayer::~BoardLayer() {
+    if (target)
+        SDL_DestroyTexture(target);
+    game->animations->trackSettled = false;
+    game->animations->settled.clear();
+}
+
+bool BoardLayer::init() {
+    if (!SDL_RenderTargetSupported(engine->renderer)) {
+        errorLog << "BoardLayer: render targets not supported\n";
+        return false;
+    }
+    pixelWidth = game->boxMap->width * BOX_TILE_WIDTH;
+    pixelHeight = game->boxMap->height * BOX_TILE_HEIGHT;
+    SDL_RendererInfo info;
+    if (SDL_GetRendererInfo(engine->renderer, &info) == 0 && info.max_texture_width > 0) {
+        if (pixelWidth > info.max_texture_width || pixelHeight > info.max_texture_height) {
+            errorLog << "BoardLayer: board too big for a texture: " << pixelWidth << "X" << pixelHeight << "\n";
+            return false;
+        }
+    }
+
+    target = SDL_CreateTexture(engine->renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_TARGET, pixelWidth, pixelHeight);
+    if (!target) {
+        errorLog << "BoardLayer: can't create render target: " << SDL_GetError() << "\n";
+        return false;
+    }
+    SDL_SetTextureBlendMode(target, SDL_BLENDMODE_BLEND); // empty tiles are transparent
+
+    game->animations->trackSettled = true;
+    full = true;
+    return true;
+}
+
+// clears the tile and draws its box unless the box is moving. Expects the render target to be set.
+void BoardLayer::redrawTile(int tilex, int tiley) {
+    SDL_Rect tileRect;
+    tileRect.x = tilex * BOX_TILE_WIDTH;
+    tileRect.y = tiley * BOX_TILE_HEIGHT;
+    tileRect.w = BOX_TILE_WIDTH;
+    tileRect.h = BOX_TILE_HEIGHT;
+    SDL_RenderFillRect(engine->renderer, &tileRect);
+
+    BoxSprite* boxSprite = game->boxMap->at(tilex, tiley);
+    if (boxSprite && !boxSprite->animator && boxSprite->renderable) {
+        SDL_Rect whole;
+        whole.x = 0;
+        whole.y = 0;
+        whole.w = boxSprite->renderable->blitWidth;
+        whole.h = boxSprite->renderable->blitHeight;
+        if (engine->batching)
+            boxSprite->renderable->queue(tileRect.x, tileRect.y, whole, &engine->batch);
+        else
+            boxSprite->renderable->render(tileRect.x, tileRect.y, whole, engine);
+    }
+    redrawnTiles ++;
+}
+
+void BoardLayer::redrawAll() {
+    SDL_RenderClear(engine->renderer);
+    BoxMap* boxMap = game->boxMap;
+    for (int bit = boxMap->occupied.next(0); bit != -1; bit = boxMap->occupied.next(bit+1))
+        redrawTile(bit / boxMap->height, bit % boxMap->height);
+}
+
+void BoardLayer::render() {
+    SDL_Renderer* renderer = engine->renderer;
+    BoxMap* boxMap = game->boxMap;
+    Animations* animations = game->animations;
+    redrawnTiles = 0;
+
+    // boxes that stopped moving become part of the layer
+    for (size_t k=0; k < animations->settled.size(); k++) {
+        Sprite* sprite = animations->settled[k];
+        int tilex = (int) ((sprite->pos.x - game->mapPos.x) / BOX_TILE_WIDTH + 0.5);
+        int tiley = (int) ((sprite->pos.y - game->mapPos.y) / BOX_TILE_HEIGHT + 0.5);
+        if (boxMap->at(tilex, tiley) == sprite)
+            boxMap->changed.add(boxMap->bitIndex(tilex, tiley));
+    }
+    animations->settled.clear();
+
+    if (full || !boxMap->changed.empty()) {
+        SDL_SetRenderTarget(renderer, target);
+        SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_NONE); // clearing writes transparent pixels
+        SDL_SetRenderDrawColor(renderer, 0, 0, 0, 0);
+        if (full) {
+            redrawAll();
+            full = false;
+        } else {
+            for (int k=0; k < boxMap->changed.size(); k++) {
+                int bit = boxMap->changed[k];
+                redrawTile(bit / boxMap->height, bit % boxMap->height);
+            }
+        }
+        if (engine->batching)
+            engine->batch.flush(renderer);
+        SDL_SetRenderTarget(renderer, NULL);
+    }
+    boxMap->changed.clear();
+
+    // copy the visible part of the layer
+    Point2 screenCoords;
+    engine->worldToScreen(game->mapPos, screenCoords);
+    SDL_Rect clippedSourceRect;
+    if (!engine->clipping->clipped(screenCoords, pixelWidth, pixelHeight, clippedSourceRect)) {
+        SDL_Rect destRect;
+        destRect.x = screenCoords.x + clippedSourceRect.x;
+        destRect.y = screenCoords.y + clippedSourceRect.y;
+        destRect.w = clippedSourceRect.w;
+        destRect.h = clippedSourceRect.h;
+        SDL_RenderCopy(renderer, target, &clippedSourceRect, &destRect);
+    }
+
+    // moving boxes on top
+    AnimatorPool::Index it = animations->animators.iter();
+    Animator* animator;
+    while (it != -1) {
+        it = animations->animators.nextp(it, animator);
+        if (animator->sprite->renderable)
+            animator->sprite->render(engine);
+    }
+    if (engine->batching)
+        engine->batch.flush(renderer);
+}
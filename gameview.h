@@ -0,0 +1,65 @@
+#ifndef _GAMEVIEW_H_
+#define _GAMEVIEW_H_
+
+// The SDL side of the game. Everything in game.h that needs a renderer to be seen.
+
+#include "engine.h"
+#include "game.h"
+
+enum ImageId {
+    RED_BLOCK,
+    BLUE_BLOCK,
+    ORANGE_BLOCK,
+    GREY_BLOCK,
+    BROWN_BLOCK,
+    GREEN_BLOCK,   
+    
+     
+};
+
+
+// builds boxes that carry a bitmap for their color. All boxes of a color share the same renderable (flyweight), so
+// creating a box allocates the sprite and nothing else.
+class BitmapBoxFactory : public BoxFactory {
+private:
+    Resources* resources;
+    RenderableBitmap* renderables[GREEN_BOX+1] = {}; // indexed by BoxId. Owned.
+
+public:
+    BitmapBoxFactory(Resources* resources, int capacity); // images should already be registered
+    ~BitmapBoxFactory();
+
+    virtual BoxSprite* create(BoxId boxId);
+
+};
+
+
+// Cached image of the settled boxes. Boxes that are not moving are drawn once into an offscreen texture and drawn
+// again only when their tile changes (see BoxMap::changed) or when they stop moving. Each frame the texture is copied
+// to the screen and only the boxes that have an animator are drawn on top of it, so the cost of a frame follows the
+// number of moving boxes and not the size of the board.
+class BoardLayer {
+private:
+    Game* game;
+    Engine* engine;
+    SDL_Texture* target = 0; // owned
+    int pixelWidth = 0;
+    int pixelHeight = 0;
+    bool full = true; // redraw all tiles on the next render()
+
+    void redrawTile(int tilex, int tiley);
+    void redrawAll();
+
+public:
+    int redrawnTiles = 0; // during the last render()
+
+    BoardLayer(Game* game, Engine* engine) : game(game), engine(engine) {}
+    ~BoardLayer();
+
+    bool init(); // false if the renderer can't hold the board in a render target. Use BoxMap::renderBoxes() then.
+    void invalidate() { full = true; } // e.g. after the render targets got reset
+    void render();
+};
+
+
+#endif
@@ -1,7 +1,12 @@
 #ifndef LISTPOOL_H
 #define LISTPOOL_H
 
+#include <vector>
+
 // T is the content class, I is the index type used to point inside the items array
+// Items live in blocks. The first one holds the capacity asked for. A growable pool appends another block when it runs
+// dry instead of failing, so items never move and pointers returned by getp() stay valid. Once the pool has grown to
+// its high-water mark it does not allocate again.
 template <class T, class I=int>
 class ListPool
 {
@@ -19,80 +24,106 @@ public:
     };
 
 private:
-    ListItem* items;
-    int capacity;
+    std::vector<ListItem*> blocks;
+    int blockShift; // block k starts at index k << blockShift. Added blocks are that big, the first may be smaller.
+    int capacity; // items in all blocks
+    bool growable;
     Index iUsed; // items used
     Index iAvailable; // items available
     int usedCount;
-    int availableCount;
-public:
+    int highWaterMark; // most items used at the same time
 
-    ListPool(int capacity) : capacity(capacity), items(new ListItem[capacity])  {
-        Index previous = -1;
-        for (int i=0; i<capacity; i++) {
-            items[i].previous = -1;
-            items[i].next = i+1;
-            items[i].used = false;
+    inline ListItem& item(Index i) {
+        return blocks[i >> blockShift][i & ((1 << blockShift) - 1)];
+    }
 
-            previous = i;
+    // chains a new block of items to the available ones
+    void addBlock(int blockCapacity) {
+        ListItem* block = new ListItem[blockCapacity];
+        Index first = blocks.size() << blockShift;
+        blocks.push_back(block);
+        for (int k=0; k<blockCapacity; k++) {
+            block[k].previous = -1;
+            block[k].next = first + k + 1;
+            block[k].used = false;
         }
-        items[capacity-1].next = -1; // mark the end
+        block[blockCapacity-1].next = iAvailable; // -1 unless there still are free items
+        iAvailable = first;
+        capacity += blockCapacity;
+    }
+
+public:
+
+    // a growable pool grows by 'capacity' rounded up to a power of two at a time
+    ListPool(int capacity, bool growable = false) : capacity(0), growable(growable) {
+        if (capacity < 1)
+            capacity = 1;
+        blockShift = 0;
+        while ((1 << blockShift) < capacity)
+            blockShift ++;
 
         iUsed = -1;
+        iAvailable = -1;
         usedCount = 0;
-        iAvailable = 0; // point to the first item in the array by definition
+        highWaterMark = 0;
+        addBlock(capacity);
     }
 
-    // returns -1 if no more items available
+    // returns -1 if no more items available. Never for a growable pool.
     Index use() {
         if (iAvailable == -1) {
-            return -1;
+            if (!growable)
+                return -1;
+            addBlock(1 << blockShift);
         }
         Index i = iAvailable;
-        iAvailable = items[i].next;
+        ListItem& newItem = item(i);
+        iAvailable = newItem.next;
         if (iUsed == -1) {
-            items[i].next = iUsed; // i.e. -1
+            newItem.next = iUsed; // i.e. -1
             iUsed = i;
-            items[i].previous = -1; // it's the first one. Nothing comes before it.
+            newItem.previous = -1; // it's the first one. Nothing comes before it.
         } else {
-            items[i].next = iUsed;
-            items[iUsed].previous = i;
+            newItem.next = iUsed;
+            item(iUsed).previous = i;
             iUsed = i;
-            items[i].previous = -1;
+            newItem.previous = -1;
         }
         usedCount ++;
-        items[i].used = true;
+        if (usedCount > highWaterMark)
+            highWaterMark = usedCount;
+        newItem.used = true;
         return i;
     }
 
     // returns false if item not used. 'true' if successfully released
     bool release(Index i) {
-        // TODO - check if this is on the Used list. In debug mode go through the list until iUsed is found or capacity exceeded. ?
-        if (!items[i].used)
+        ListItem& released = item(i);
+        if (!released.used)
             return false;
         // remove from Used
-        Index n = items[i].next;
-        Index p = items[i].previous;
+        Index n = released.next;
+        Index p = released.previous;
         if (n != -1)
-            items[n].previous = p;
+            item(n).previous = p;
         if (p != -1)
-            items[p].next = n;
+            item(p).next = n;
         if (iUsed == i) {
-            iUsed = items[i].next;
+            iUsed = released.next;
         }
         // put to Available
         if (iAvailable != -1) {
-            items[iAvailable].previous = i;
-            items[i].next = iAvailable;
-            items[i].previous = -1;
+            item(iAvailable).previous = i;
+            released.next = iAvailable;
+            released.previous = -1;
             iAvailable = i;
         } else {
             iAvailable = i;
-            items[i].previous = -1;
-            items[i].next = -1;
+            released.previous = -1;
+            released.next = -1;
         }
         usedCount --;
-        items[i].used = false;
+        released.used = false;
         return true;
     }
 
@@ -100,7 +131,7 @@ public:
     inline Index get(T& newItem) {
         Index index = use();
         if (index != -1)
-                newItem = items[index].content;
+                newItem = item(index).content;
         return index;
     }
 
@@ -109,16 +140,21 @@ public:
     inline Index getp(T*& newItemp) {
         Index index = use();
         if (index != -1)
-                newItemp = &(items[index].content);
+                newItemp = &(item(index).content);
         return index;
 
     }
 
-    // true if no more available items to return
+    // true if no more available items to return. A growable pool adds a block on the next use().
     bool dry() {
         return (iAvailable == -1);
     }
 
+    // true if use() would fail
+    bool exhausted() {
+        return (iAvailable == -1 && !growable);
+    }
+
     Index iter() {
         return iUsed;
     }
@@ -127,8 +163,9 @@ public:
     // returns -1 when no more items
     Index nextp(Index it, T*& nextItem) {
         if (it != -1) {
-            nextItem = &(items[it].content);
-            return items[it].next;
+            ListItem& current = item(it);
+            nextItem = &(current.content);
+            return current.next;
         } else {
             return -1;
         }
@@ -138,10 +175,19 @@ public:
         return usedCount;
     }
 
+    inline int getCapacity() {
+        return capacity;
+    }
+
+    // size the pool with this to never grow again under the same load
+    inline int getHighWaterMark() {
+        return highWaterMark;
+    }
+
 
     ~ListPool() {
-        if (items)
-            delete [] items;
+        for (int k=0; k < (int) blocks.size(); k++)
+            delete [] blocks[k];
     }
 };
 
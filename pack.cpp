@@ -0,0 +1,131 @@
+#include "utils.h"
+LogStream<LOG_INFO> infoLog(std::cout);
+LogStream<LOG_ERROR> errorLog(std::cerr);
+LogStream<LOG_WARNING> warningLog(std::cerr);
+
+#include "assetpack.h"
+#include <SDL.h>
+#include <SDL_image.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+// Offline asset packer. Decodes images and writes them to a pack that Resources::openPack() maps at startup, so the
+// game uploads pixels to textures with no decoding and no format conversion.
+//
+//   boxes-pack [--format argb8888|abgr8888] OUT FILE...
+//
+// FILEs are stored under the path given here, which should be the one the game registers them with, e.g.
+//
+//   boxes-pack files/boxes.pack ./files/red.png ./files/blue.png ...
+//
+// The default format is ARGB8888, the one most renderers list first. Resources works with a pack of another format
+// too, the renderer then converts when uploading.
+
+
+static uint64_t aligned(uint64_t offset) {
+    return (offset + PACK_ALIGN - 1) / PACK_ALIGN * PACK_ALIGN;
+}
+
+// false on a short write. 'written' counts the bytes that made it.
+static bool writeAll(FILE* out, const void* data, size_t size, uint64_t& written) {
+    size_t done = fwrite(data, 1, size, out);
+    written += done;
+    return done == size;
+}
+
+int main(int argc, char** args) {
+    Uint32 format = SDL_PIXELFORMAT_ARGB8888;
+    int first = 1;
+    if (argc > 2 && !strcmp(args[1], "--format")) {
+        if (!strcmp(args[2], "argb8888")) {
+            format = SDL_PIXELFORMAT_ARGB8888;
+        } else if (!strcmp(args[2], "abgr8888")) {
+            format = SDL_PIXELFORMAT_ABGR8888;
+        } else {
+            errorLog << "unknown format " << args[2] << "\n";
+            return 1;
+        }
+        first = 3;
+    }
+    if (argc - first < 2) {
+        errorLog << "usage: " << args[0] << " [--format argb8888|abgr8888] OUT FILE...\n";
+        return 1;
+    }
+    const char* packfile = args[first];
+    int count = argc - first - 1;
+
+    if ((IMG_Init(IMG_INIT_PNG|IMG_INIT_JPG) & IMG_INIT_PNG) == 0) {
+        errorLog << "error starting image loader: " << IMG_GetError() << "\n";
+        return 1;
+    }
+
+    // decode everything first, the index goes before the pixels
+    std::vector<SDL_Surface*> images;
+    std::vector<PackEntry> entries(count);
+    uint64_t offset = aligned(sizeof(PackHeader) + count*sizeof(PackEntry));
+    bool failed = false;
+    for (int k=0; k < count && !failed; k++) {
+        const char* path = args[first + 1 + k];
+        if (strlen(path) >= PACK_PATH_SIZE) {
+            errorLog << "path too long: " << path << "\n";
+            failed = true;
+            break;
+        }
+        SDL_Surface* decoded = IMG_Load(path);
+        SDL_Surface* image = decoded ? SDL_ConvertSurfaceFormat(decoded, format, 0) : 0;
+        if (decoded)
+            SDL_FreeSurface(decoded);
+        if (!image) {
+            errorLog << "can't load " << path << ": " << IMG_GetError() << "\n";
+            failed = true;
+            break;
+        }
+        images.push_back(image);
+
+        PackEntry& entry = entries[k];
+        memset(&entry, 0, sizeof(entry));
+        strcpy(entry.path, path);
+        entry.w = image->w;
+        entry.h = image->h;
+        entry.pitch = image->pitch;
+        entry.offset = offset;
+        offset = aligned(offset + (uint64_t) image->pitch*image->h);
+        infoLog << path << " " << image->w << "X" << image->h << "\n";
+    }
+
+    FILE* out = failed ? 0 : fopen(packfile, "wb");
+    if (!failed && !out) {
+        errorLog << "can't write " << packfile << "\n";
+        failed = true;
+    }
+    if (!failed) {
+        PackHeader header;
+        header.magic = PACK_MAGIC;
+        header.version = PACK_VERSION;
+        header.pixelFormat = format;
+        header.count = count;
+        char padding[PACK_ALIGN];
+        memset(padding, 0, sizeof(padding));
+        // stop at the first short write. The padding up to the next offset only fits 'padding' while all went out.
+        uint64_t written = 0;
+        bool ok = writeAll(out, &header, sizeof(header), written)
+            && writeAll(out, entries.data(), count*sizeof(PackEntry), written);
+        for (int k=0; k < count && ok; k++) {
+            ok = writeAll(out, padding, entries[k].offset - written, written)
+                && writeAll(out, images[k]->pixels, (size_t) images[k]->pitch*images[k]->h, written);
+        }
+        if (fclose(out) != 0 || !ok) {
+            errorLog << "can't write " << packfile << "\n";
+            failed = true;
+        }
+    }
+
+    for (size_t k=0; k < images.size(); k++)
+        SDL_FreeSurface(images[k]);
+    IMG_Quit();
+    if (failed)
+        return 1;
+    infoLog << "packed " << count << " images in " << packfile << "\n";
+    return 0;
+}
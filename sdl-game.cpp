@@ -1,16 +1,98 @@
 #include "utils.h"
-LogStream infoLog(std::cout);
-LogStream errorLog(std::cerr);
-LogStream warningLog(std::cerr);
+LogStream<LOG_INFO> infoLog(std::cout);
+LogStream<LOG_ERROR> errorLog(std::cerr);
+LogStream<LOG_WARNING> warningLog(std::cerr);
 
 #include "engine.h"
-#include "game.h"
+#include "gameview.h"
+#include "trace.h"
+#include <string.h>
+
+// The game state advances in fixed steps regardless of the frame rate. Animator steps are counted in these ticks.
+#define SIM_TICK_MILLIS 16.666667
+#define MAX_FRAME_MILLIS 250 // after a hitch, don't try to catch up with more than that
+
+
+// reacts to what the mouse and the game post. The queue is drained once per frame, before the simulation ticks.
+struct GameEvents : public EventHandler {
+    Game* game;
+    bool gameOver = false;
+    bool feeding = false; // a new column is shifting in. Don't feed another one by hand yet.
+
+    GameEvents(Game* game) : game(game) {}
+
+    void handle(EventType type, int64_t value) {
+        switch (type) {
+            case EVENT_MOUSE_RELEASED:
+                click(unpackX(value), unpackY(value));
+            break;
+            case EVENT_CLUSTER_DISCARDED:
+                infoLog << (int) value << " tiles discarded\n";
+            break;
+            case EVENT_COLUMN_SETTLED:
+                if (value == game->boxMap->width-1)
+                    feeding = false; // the new column is in
+            break;
+            case EVENT_GAME_OVER:
+                infoLog << "GAME OVER\n";
+                gameOver = true;
+            break;
+            default:
+            break;
+        }
+    }
+
+    // discard same-color on click
+    void click(int mouseX, int mouseY) {
+        int tileX = 0;
+        int tileY = 0;
+        if ( game->tileXYAt(mouseX, mouseY, tileX, tileY) ) {
+            BoxSprite* clickedSprite = game->boxMap->at(tileX, tileY);
+            if (clickedSprite) {
+                infoLog << "Mouse released at tile (" << tileX << "," << tileY << ") - " << clickedSprite->boxId << "\n";
+                int discardedCount = 0;
+                game->discardSameColor(tileX, tileY, discardedCount);
+            } else {
+                infoLog << "Mouse released at tile (" << tileX << "," << tileY << ") - " << "no tile there\n";
+            }
+        } else {
+            infoLog << "Mouse released outside of box map\n";
+        }
+    }
+};
 
   
 int main(int argc, char** args) {
     
     Animations* animations = new Animations(224);
+    animations->tickMillis = SIM_TICK_MILLIS;
+    EventQueue events;
+    animations->events = &events;
     Engine engine(animations);
+    engine.mouseState.events = &events;
+    FrameTimer frameTimer;
+    FrameTimeOverlay frameTimeOverlay;
+    bool showFrameTimes = false;
+    const char* frameCsvFile = 0; // per-frame phase times are written here on exit
+    const char* traceFile = 0; // Chrome trace written here on exit
+    bool atlasMode = true; // pack all images in one atlas texture
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(args[i], "--no-vsync"))
+            engine.vsync = false; // render as fast as possible
+        else if (!strcmp(args[i], "--frame-times"))
+            showFrameTimes = true;
+        else if (!strcmp(args[i], "--frame-csv") && i+1 < argc)
+            frameCsvFile = args[++i];
+        else if (!strcmp(args[i], "--trace") && i+1 < argc)
+            traceFile = args[++i];
+        else if (!strcmp(args[i], "--no-atlas"))
+            atlasMode = false; // a texture per image, loaded on first draw
+    }
+    if (frameCsvFile)
+        frameTimer.logFrames();
+    if (traceFile)
+        tracer.start();
 
     if (!engine.initialize()) {
         return 1;
@@ -20,69 +102,85 @@ int main(int argc, char** args) {
     BoxMap* boxMap = 0;
     BoxFactory* boxFactory = 0;
     Game* game = 0;
-    Uint32 lastFeedMillis; // count milllis since last time we fed a column
+    BoardLayer* boardLayer = 0;
+    double simMillis = 0; // simulated time
+    double lastFeedMillis = 0; // simulated time when we last fed a column
 
-    resources = new Resources(engine.renderer);
+    resources = new Resources(engine.renderer, "", 16, atlasMode);
     resources->init();
-    resources->registerImage("./files/red.png", RED_BLOCK);
-    resources->registerImage("./files/blue.png", BLUE_BLOCK);
-    resources->registerImage("./files/orange.png", ORANGE_BLOCK);
-    resources->registerImage("./files/grey.png", GREY_BLOCK);
-    resources->registerImage("./files/brown.png", BROWN_BLOCK);
-    resources->registerImage("./files/green.png", GREEN_BLOCK);
+    if (!resources->openPack("./files/boxes.pack"))
+        infoLog << "No asset pack, decoding the images. See pack.cpp to make one.\n";
+    resources->registerImageAsync("./files/red.png", RED_BLOCK);
+    resources->registerImageAsync("./files/blue.png", BLUE_BLOCK);
+    resources->registerImageAsync("./files/orange.png", ORANGE_BLOCK);
+    resources->registerImageAsync("./files/grey.png", GREY_BLOCK);
+    resources->registerImageAsync("./files/brown.png", BROWN_BLOCK);
+    resources->registerImageAsync("./files/green.png", GREEN_BLOCK);
+    // keep the window alive while the images decode. Nothing to draw until the boxes are in.
+    const int boxImages[] = {RED_BLOCK, BLUE_BLOCK, ORANGE_BLOCK, GREY_BLOCK, BROWN_BLOCK, GREEN_BLOCK};
+    while (!resources->imagesLoaded(boxImages, sizeof(boxImages)/sizeof(boxImages[0]))) {
+        resources->pump(4);
+        SDL_PumpEvents();
+        SDL_SetRenderDrawColor(engine.renderer, 0, 0, 0, SDL_ALPHA_OPAQUE);
+        SDL_RenderClear(engine.renderer);
+        SDL_RenderPresent(engine.renderer);
+    }
     resources->done(); 
 
     boxMap = new BoxMap(14, 8);
-    boxFactory = new BoxFactory(resources);
-    game = new Game(boxMap, boxFactory, &engine);
+    boxFactory = new BitmapBoxFactory(resources, boxMap->width*boxMap->height + boxMap->height); // a full map and a column being fed
+    game = new Game(boxMap, boxFactory, animations, engine.camera);
     game->mapPos.y = 64*2; // push some space at the top
+    game->events = &events;
+    GameEvents gameEvents(game);
+    events.subscribe(EVENT_MOUSE_RELEASED, &gameEvents);
+    events.subscribe(EVENT_CLUSTER_DISCARDED, &gameEvents);
+    events.subscribe(EVENT_COLUMN_SETTLED, &gameEvents);
+    events.subscribe(EVENT_GAME_OVER, &gameEvents);
+
+    boardLayer = new BoardLayer(game, &engine);
+    if (!boardLayer->init()) {
+        infoLog << "Drawing the whole board every frame\n";
+        delete boardLayer;
+        boardLayer = 0;
+    }
 
     engine.clipping->set(Point2(50,50), 800,500);
 
-    infoLog << "Press k to feed new columns manually\n";
+    infoLog << "Press k to feed new columns manually, f to show frame times, t to print them\n";
+    frameTimeOverlay.pos = Point2(60, 8);
 
     engine.mouseState.update(); // initialize mouse state
 
-    lastFeedMillis = SDL_GetTicks();
+    Uint64 counterFrequency = SDL_GetPerformanceFrequency();
+    Uint64 lastCounter = SDL_GetPerformanceCounter();
+    double accumulatedMillis = 0; // real time not simulated yet
 	SDL_Event ev;
 	bool running = true;
-    int coolingDown = 0;
+    int hoveredCluster = -1;
 
     // main loop
 	while (running) {
+        frameTimer.beginFrame();
         
-        // discard same-color on click
+        // clicks are posted to the event queue and handled below, with the rest of the events
+        frameTimer.begin(PHASE_INPUT);
         engine.mouseState.update();
-        if (engine.mouseState.leftReleased) {
-            int mouseReleasedTileX = 0;
-            int mouseReleasedTileY = 0;
-            if ( game->tileXYAt(engine.mouseState.mouseX, engine.mouseState.mouseY, mouseReleasedTileX, mouseReleasedTileY) ) {
-                BoxSprite*& clickedSprite = game->boxMap->at(mouseReleasedTileX, mouseReleasedTileY);
-                if (clickedSprite) {
-                    infoLog << "Mouse released at tile (" << mouseReleasedTileX << "," << mouseReleasedTileY << ") - " << clickedSprite->boxId << "\n";
-                    int discardedCount = 0;
-                    game->discardSameColor(mouseReleasedTileX, mouseReleasedTileY, discardedCount, BoxId::UNDEFINED_BOX);
-                    infoLog << discardedCount << " tiles discarded\n";                    
-                } else {
-                    infoLog << "Mouse released at tile (" << mouseReleasedTileX << "," << mouseReleasedTileY << ") - " << "no tile there\n";
-                }                
-            } else {
-                infoLog << "Mouse released outside of box map\n";
-            }
+
+        // report the cluster under the cursor when the cursor moves to another one
+        int hoveredTileX, hoveredTileY;
+        int cluster = -1;
+        if ( game->tileXYAt(engine.mouseState.mouseX, engine.mouseState.mouseY, hoveredTileX, hoveredTileY) )
+            cluster = game->boxMap->clusterOf(hoveredTileX, hoveredTileY);
+        if (cluster != hoveredCluster) {
+            if (cluster != -1)
+                infoLog << "cluster under cursor: " << game->boxMap->clusterSize(hoveredTileX, hoveredTileY) << " boxes\n";
+            hoveredCluster = cluster;
         }
-        
-        // gravity
-        int movedCount = game->gravityEffect();
-        if (movedCount)
-            infoLog << "moved by 1st gravity: " << movedCount << "\n";
-        movedCount = game->gravityEffect();
-        if (movedCount)
-            infoLog << "moved by 2nd gravity: " << movedCount << "\n";
-        
-        // condense empty columns
-        game->condense();
+        frameTimer.end(PHASE_INPUT);
         
 		// event loop, generate new column on "k"
+        frameTimer.begin(PHASE_EVENTS);
 		while (SDL_PollEvent(&ev) != 0) {
 			// check event type
 			switch (ev.type) {
@@ -90,61 +188,114 @@ int main(int argc, char** args) {
                     // shut down
                     running = false;
                 break;
+                case SDL_RENDER_TARGETS_RESET:
+                    if (boardLayer)
+                        boardLayer->invalidate(); // cached board image is lost
+                break;
                 case SDL_KEYDOWN:
                     MoveStatus moveStatus;
                     GameStatus gameStatus;
                     switch (ev.key.keysym.sym) {
                         case SDLK_k:
-                            if (!coolingDown) {
+                            if (!gameEvents.feeding) { // wait for the previous column to shift in
                                 gameStatus = game->newColumn();
-                                coolingDown = 30; // prevent manually adding newColumn before 30 ticks
-                                if (gameStatus == GameStatus::GAME_OVER) {
-                                    infoLog << "GAME OVER\n";
-                                }
+                                gameEvents.feeding = (gameStatus == GameStatus::GAME_OK);
                             }
                         break;   
                         case SDLK_c:
-                            infoLog << animations->animators.getUsedCount() << "\n";
+                            infoLog << animations->animators.getUsedCount() << " animators, at most " << animations->animators.getHighWaterMark() << "\n";
+                        break;
+                        case SDLK_f:
+                            showFrameTimes = !showFrameTimes;
+                        break;
+                        case SDLK_t:
+                            for (int phase = 0; phase < PHASE_COUNT; phase++)
+                                infoLog << FrameTimer::phaseNames[phase] << " p50/p99/max us: " << (int) frameTimer.percentile((FramePhase) phase, 0.5f)
+                                    << " / " << (int) frameTimer.percentile((FramePhase) phase, 0.99f) << " / " << (int) frameTimer.max((FramePhase) phase) << "\n";
                         break;
                     }
                 break;
 			}
 		}
+        events.drain();
+        if (gameEvents.gameOver)
+            running = false;
+        frameTimer.end(PHASE_EVENTS);
         
-        // feed a column from the right side when the time comes (see Game::columnFeedPeriod)
-        Uint32 currentMillis = SDL_GetTicks();
-        if (currentMillis - lastFeedMillis > game->columnFeedPeriod) {
-            lastFeedMillis = currentMillis;
-            if (game->newColumn() == GameStatus::GAME_OVER) {
-                infoLog << "GAME OVER\n";
-                break;
-            } 
-            coolingDown = 30;
+        // advance the simulation by as many fixed ticks as the real time elapsed allows
+        Uint64 counter = SDL_GetPerformanceCounter();
+        double frameMillis = (counter - lastCounter)*1000.0/counterFrequency;
+        lastCounter = counter;
+        accumulatedMillis += frameMillis < MAX_FRAME_MILLIS ? frameMillis : MAX_FRAME_MILLIS;
 
-        }
+        while (running && accumulatedMillis >= SIM_TICK_MILLIS) {
+            // gravity
+            frameTimer.begin(PHASE_GRAVITY1);
+            int movedCount = game->gravityEffect();
+            frameTimer.end(PHASE_GRAVITY1);
+            if (movedCount)
+                infoLog << "moved by 1st gravity: " << movedCount << "\n";
+            frameTimer.begin(PHASE_GRAVITY2);
+            movedCount = game->gravityEffect();
+            frameTimer.end(PHASE_GRAVITY2);
+            if (movedCount)
+                infoLog << "moved by 2nd gravity: " << movedCount << "\n";
         
-        // animate
-        animations->tick();
+            // condense empty columns
+            frameTimer.begin(PHASE_CONDENSE);
+            game->condense();
+            frameTimer.end(PHASE_CONDENSE);
+
+            // feed a column from the right side when the time comes (see Game::columnFeedPeriod)
+            if (simMillis - lastFeedMillis > game->columnFeedPeriod) {
+                lastFeedMillis = simMillis;
+                if (game->newColumn() == GameStatus::GAME_OVER)
+                    break; // GameEvents stops us
+                gameEvents.feeding = true;
+            }
+
+            // animate
+            frameTimer.begin(PHASE_ANIMATE);
+            animations->tick();
+            frameTimer.end(PHASE_ANIMATE);
+
+            simMillis += SIM_TICK_MILLIS;
+            accumulatedMillis -= SIM_TICK_MILLIS;
+        }
+        // render the moving sprites part way between the last two ticks
+        engine.interpolation = accumulatedMillis / SIM_TICK_MILLIS;
         
         //Clear screen
+        frameTimer.begin(PHASE_RENDER);
         SDL_SetRenderDrawColor(engine.renderer, 0, 0, 0, SDL_ALPHA_OPAQUE);
         SDL_RenderClear(engine.renderer );
         
         // rendering
-        game->boxMap->renderBoxes(&engine);
+        if (boardLayer)
+            boardLayer->render();
+        else
+            game->boxMap->renderBoxes(&engine, game->mapPos);
+        if (showFrameTimes)
+            frameTimeOverlay.render(engine.renderer, &frameTimer);
+        frameTimer.end(PHASE_RENDER);
 
-        // page flipping (?)
+        // page flipping. Blocks until the next refresh when vsync is on.
+        frameTimer.begin(PHASE_PRESENT);
         SDL_RenderPresent(engine.renderer);
+        frameTimer.end(PHASE_PRESENT);
 
-		// Wait before next frame. Rough assumption of a 60Hz monitor, 2ms for rendereing a 14ms for waiting. 1sec/60 = 16.6ms
-		SDL_Delay(14);
-
-        // decrease cooldown counter. Cooldown allows newColumn to be added only after the previous has settled.
-        if (coolingDown > 0)
-            coolingDown--;
+        frameTimer.endFrame();
 	}
 
+    infoLog << "animators used at most: " << animations->animators.getHighWaterMark() << "\n";
+    if (events.getDropped())
+        warningLog << (int) events.getDropped() << " events dropped, the queue was full\n";
+    if (frameCsvFile && frameTimer.writeCsv(frameCsvFile))
+        infoLog << "frame times written to " << frameCsvFile << "\n";
+
 
+    if (boardLayer)
+        delete boardLayer;
     if (game)
         delete game;
     if (boxFactory)
@@ -155,6 +306,14 @@ int main(int argc, char** args) {
         delete boxMap;
     if (resources)
         delete resources;
+
+    if (traceFile) {
+        tracer.stop(); // the decoder threads are gone with 'resources'
+        if (tracer.getDropped())
+            warningLog << tracer.getDropped() << " trace events dropped, the buffer was full\n";
+        if (tracer.writeJson(traceFile))
+            infoLog << "trace written to " << traceFile << ". Open it in chrome://tracing or ui.perfetto.dev\n";
+    }
         
     engine.close();
 
@@ -0,0 +1,330 @@
+#include "utils.h"
+LogStream<LOG_INFO> infoLog(std::cout);
+LogStream<LOG_ERROR> errorLog(std::cerr);
+LogStream<LOG_WARNING> warningLog(std::cerr);
+
+#include "game.h"
+#include "trace.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+// Headless simulator. Plays random or scripted games with no renderer, as fast as the CPU allows.
+//
+//   boxes-sim [--width W] [--height H] [--seed S] [--ticks N] [--feed-period T] [--click-chance P] [--script FILE]
+//             [--animators N] [--events N] [--trace FILE]
+//
+// A tick does what one iteration of the sdl-game main loop does: click, gravity twice, condense, feed, animate.
+// Random games feed a column every 'feed-period' ticks and click a random tile with a 1/P chance per tick. When a
+// game is over the board is cleared and a new one starts until 'ticks' run out.
+//
+// --animators sets the initial size of the animator pool. The default fits a full board, a smaller one makes the pool
+// grow under load, which shows in traces as "animator pool grows".
+// --events sets the size of the event queue, 1024 by default like sdl-game's.
+// --trace writes a timeline of the run that chrome://tracing and ui.perfetto.dev open. Keep 'ticks' low, a tick
+// records several events and the trace buffer holds about a million.
+//
+// Scripts are text files with one command per line. Empty lines and lines starting with # are skipped.
+//
+//   click X Y     click on tile (X,Y)
+//   feed          add a new column from the right
+//   tick [N]      run N ticks (default 1). No columns are fed automatically while scripted.
+//   post E [N]    post N events of type E (default 1) straight to the event queue. E is animation-done or
+//                 column-settled.
+//   drain         deliver the queued events now, like the next tick would
+//   expect E N    fail unless N events of type E were delivered so far
+
+
+struct SimStats {
+    long ticks = 0;
+    long clicks = 0;
+    long discarded = 0;
+    long fed = 0;
+    long fell = 0;
+    long games = 1;
+    long gameOvers = 0;
+    long animationsDone = 0; // events delivered
+    long columnsSettled = 0;
+    long gameOverEvents = 0;
+};
+
+// Counts delivered events, so that a run shows whether the ones the game relies on get through
+struct SimEvents : public EventHandler {
+    SimStats& stats;
+
+    SimEvents(SimStats& stats) : stats(stats) {}
+
+    void handle(EventType type, int64_t) {
+        if (type == EVENT_ANIMATION_DONE)
+            stats.animationsDone ++;
+        else if (type == EVENT_COLUMN_SETTLED)
+            stats.columnsSettled ++;
+        else if (type == EVENT_GAME_OVER)
+            stats.gameOverEvents ++;
+    }
+};
+
+// script name of an event type. Game over is left out, the run checks those against the games played.
+static bool eventTypeOf(const std::string& name, EventType& type) {
+    if (name == "animation-done")
+        type = EVENT_ANIMATION_DONE;
+    else if (name == "column-settled")
+        type = EVENT_COLUMN_SETTLED;
+    else
+        return false;
+    return true;
+}
+
+struct Simulator {
+    Game* game;
+    Animations* animations;
+    SimStats stats;
+    // drained every tick, like sdl-game does every frame. Finished animations wait through the next tick's gravity, as
+    // they do when sdl-game catches up several ticks in one frame.
+    EventQueue events;
+    SimEvents simEvents;
+
+    Simulator(Game* game, Animations* animations, int eventCapacity) : game(game), animations(animations), events(eventCapacity), simEvents(stats) {
+        game->events = &events;
+        animations->events = &events;
+        events.subscribe(EVENT_ANIMATION_DONE, &simEvents);
+        events.subscribe(EVENT_COLUMN_SETTLED, &simEvents);
+        events.subscribe(EVENT_GAME_OVER, &simEvents);
+    }
+
+    void click(int tilex, int tiley) {
+        stats.clicks ++;
+        if (game->boxMap->at(tilex, tiley)) {
+            int discardedCount = 0;
+            game->discardSameColor(tilex, tiley, discardedCount);
+            stats.discarded += discardedCount;
+        }
+    }
+
+    // returns false on game over
+    bool feed() {
+        stats.fed ++;
+        GameStatus status = game->newColumn();
+        if (status == GameStatus::GAME_OVER) {
+            stats.gameOvers ++;
+            return false;
+        } else
+        if (status == GameStatus::GAME_ERROR) {
+            errorLog << "newColumn failed at tick " << (int) stats.ticks << "\n";
+        }
+        return true;
+    }
+
+    void tick() {
+        stats.fell += game->gravityEffect();
+        stats.fell += game->gravityEffect();
+        game->condense();
+        events.drain();
+        animations->tick();
+        stats.ticks ++;
+    }
+
+    long delivered(EventType type) {
+        if (type == EVENT_ANIMATION_DONE)
+            return stats.animationsDone;
+        return stats.columnsSettled;
+    }
+
+    void restart() {
+        game->clear();
+        stats.games ++;
+    }
+};
+
+
+static bool runScript(Simulator& sim, const char* scriptFile) {
+    std::ifstream script(scriptFile);
+    if (!script) {
+        errorLog << "Can't open script " << scriptFile << "\n";
+        return false;
+    }
+
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(script, line)) {
+        lineNumber ++;
+        std::istringstream words(line);
+        std::string command;
+        if (!(words >> command) || command[0] == '#')
+            continue;
+
+        if (command == "click") {
+            int tilex, tiley;
+            if (!(words >> tilex >> tiley)) {
+                errorLog << scriptFile << ":" << lineNumber << ": click needs tile coordinates\n";
+                return false;
+            }
+            sim.click(tilex, tiley);
+        } else
+        if (command == "feed") {
+            if (!sim.feed())
+                sim.restart();
+        } else
+        if (command == "tick") {
+            int count = 1;
+            words >> count;
+            for (int i=0; i < count; i++)
+                sim.tick();
+        } else
+        if (command == "post" || command == "expect") {
+            std::string name;
+            EventType type;
+            if (!(words >> name) || !eventTypeOf(name, type)) {
+                errorLog << scriptFile << ":" << lineNumber << ": " << command.c_str() << " needs an event type\n";
+                return false;
+            }
+            if (command == "post") {
+                int count = 1;
+                words >> count;
+                for (int i=0; i < count; i++)
+                    sim.events.post(type);
+            } else {
+                long expected;
+                if (!(words >> expected)) {
+                    errorLog << scriptFile << ":" << lineNumber << ": expect needs a count\n";
+                    return false;
+                }
+                if (sim.delivered(type) != expected) {
+                    errorLog << scriptFile << ":" << lineNumber << ": " << name.c_str() << " delivered " << sim.delivered(type)
+                        << " times, expected " << expected << "\n";
+                    return false;
+                }
+            }
+        } else
+        if (command == "drain") {
+            sim.events.drain();
+        } else {
+            errorLog << scriptFile << ":" << lineNumber << ": unknown command '" << command.c_str() << "'\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+static void runRandom(Simulator& sim, long ticks, int feedPeriod, int clickChance) {
+    BoxMap* boxMap = sim.game->boxMap;
+    int sinceFeed = feedPeriod; // feed on the very first tick
+    while (sim.stats.ticks < ticks) {
+        if (clickChance > 0 && randomInRange(1, clickChance) == 1)
+            sim.click(randomInRange(0, boxMap->width-1), randomInRange(0, boxMap->height-1));
+
+        if (sinceFeed >= feedPeriod) {
+            sinceFeed = 0;
+            if (!sim.feed())
+                sim.restart();
+        }
+        sim.tick();
+        sinceFeed ++;
+    }
+}
+
+
+int main(int argc, char** args) {
+    int width = 14;
+    int height = 8;
+    unsigned int seed = 1;
+    long ticks = 1000000;
+    int feedPeriod = 300; // ~5sec at 60Hz, like Game::columnFeedPeriod
+    int clickChance = 10;
+    int animatorCount = 0; // sized for the board
+    int eventCapacity = 1024;
+    const char* scriptFile = 0;
+    const char* traceFile = 0;
+
+    for (int i=1; i < argc; i++) {
+        bool hasValue = i+1 < argc;
+        if (!strcmp(args[i], "--width") && hasValue) {
+            width = atoi(args[++i]);
+        } else if (!strcmp(args[i], "--height") && hasValue) {
+            height = atoi(args[++i]);
+        } else if (!strcmp(args[i], "--seed") && hasValue) {
+            seed = strtoul(args[++i], 0, 10);
+        } else if (!strcmp(args[i], "--ticks") && hasValue) {
+            ticks = atol(args[++i]);
+        } else if (!strcmp(args[i], "--feed-period") && hasValue) {
+            feedPeriod = atoi(args[++i]);
+        } else if (!strcmp(args[i], "--click-chance") && hasValue) {
+            clickChance = atoi(args[++i]);
+        } else if (!strcmp(args[i], "--script") && hasValue) {
+            scriptFile = args[++i];
+        } else if (!strcmp(args[i], "--animators") && hasValue) {
+            animatorCount = atoi(args[++i]);
+        } else if (!strcmp(args[i], "--events") && hasValue) {
+            eventCapacity = atoi(args[++i]);
+        } else if (!strcmp(args[i], "--trace") && hasValue) {
+            traceFile = args[++i];
+        } else {
+            errorLog << "usage: " << args[0] << " [--width W] [--height H] [--seed S] [--ticks N] [--feed-period T] [--click-chance P] [--script FILE] [--animators N] [--events N] [--trace FILE]\n";
+            return 1;
+        }
+    }
+    if (width <= 0 || height <= 0 || feedPeriod <= 0 || eventCapacity <= 0) {
+        errorLog << "width, height, feed-period and events should be positive\n";
+        return 1;
+    }
+
+    srand(seed);
+
+    // a full board shifting left while its columns fall needs roughly two animators per tile. More make the pool grow,
+    // see animator_high_water.
+    Animations* animations = new Animations(animatorCount > 0 ? animatorCount : 2*width*height + height);
+    BoxMap* boxMap = new BoxMap(width, height);
+    BoxFactory* boxFactory = new BoxFactory(width*height + height); // a full map and a column being fed
+    Game* game = new Game(boxMap, boxFactory, animations);
+    Simulator sim(game, animations, eventCapacity);
+
+    if (traceFile)
+        tracer.start();
+    std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+    bool ok = true;
+    if (scriptFile)
+        ok = runScript(sim, scriptFile);
+    else
+        runRandom(sim, ticks, feedPeriod, clickChance);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - started;
+    if (traceFile) {
+        tracer.stop();
+        if (tracer.getDropped())
+            warningLog << tracer.getDropped() << " trace events dropped, the buffer was full. Run fewer ticks.\n";
+        tracer.writeJson(traceFile);
+    }
+
+    SimStats& stats = sim.stats;
+    std::cout << "board: " << width << "x" << height << "\n";
+    std::cout << "ticks: " << stats.ticks << "\n";
+    std::cout << "games: " << stats.games << "\n";
+    std::cout << "game_overs: " << stats.gameOvers << "\n";
+    std::cout << "columns_fed: " << stats.fed << "\n";
+    std::cout << "clicks: " << stats.clicks << "\n";
+    std::cout << "discarded: " << stats.discarded << "\n";
+    std::cout << "fell: " << stats.fell << "\n";
+    std::cout << "seconds: " << elapsed.count() << "\n";
+    std::cout << "animator_high_water: " << animations->animators.getHighWaterMark() << "\n";
+    std::cout << "animations_done: " << stats.animationsDone << " (" << sim.events.getDropped(EVENT_ANIMATION_DONE) << " dropped)\n";
+    std::cout << "columns_settled: " << stats.columnsSettled << "\n";
+    std::cout << "ticks_per_second: " << (elapsed.count() > 0 ? stats.ticks / elapsed.count() : 0) << "\n";
+
+    // bursts of EVENT_ANIMATION_DONE may be dropped, the events the game relies on may not
+    if (sim.events.getDropped() != sim.events.getDropped(EVENT_ANIMATION_DONE) || stats.gameOverEvents != stats.gameOvers) {
+        errorLog << "events lost: " << sim.events.getDropped() - sim.events.getDropped(EVENT_ANIMATION_DONE) << " dropped, "
+            << stats.gameOverEvents << " of " << stats.gameOvers << " game overs delivered\n";
+        ok = false;
+    }
+
+    game->clear();
+    delete game;
+    delete boxFactory;
+    delete boxMap;
+    delete animations;
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,206 @@
+#include "sprite.h"
+#include "utils.h"
+#include "trace.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// statically linked global var
+extern LogStream<LOG_ERROR> errorLog;
+extern LogStream<LOG_WARNING> warningLog;
+
+template class ListPool<Animator,int>; // instansiate class out of class template
+
+
+void Sprite::setPos(float x, float y) {
+    // TODO - check limits ?
+    pos.x = x;
+    pos.y = y;
+}
+
+float ease(Easing easing, float t) {
+    switch (easing) {
+        case EASE_IN:
+            return t*t;
+        case EASE_OUT:
+            return t*(2-t);
+        case EASE_IN_OUT:
+            return t < 0.5f ? 2*t*t : -1 + (4 - 2*t)*t;
+        default:
+            return t;
+    }
+}
+
+
+void Animator::set(Sprite* sprite, Point2 pos, float millis, Easing easing) {
+    animations->start(this, sprite, pos, millis, easing);
+}
+
+
+AnimatorLanes::AnimatorLanes(int capacity) {
+    reserve(capacity);
+}
+
+void AnimatorLanes::reserve(int capacity) {
+    fromX.resize(capacity);
+    fromY.resize(capacity);
+    toX.resize(capacity);
+    toY.resize(capacity);
+    startTime.resize(capacity);
+    endTime.resize(capacity);
+    easing.resize(capacity);
+    owners.resize(capacity);
+}
+
+int AnimatorLanes::add(Animator* owner, const Point2& from, const Point2& to, float startTime, float millis, Easing easing) {
+    if (count == (int) fromX.size())
+        reserve(count ? count*2 : 16);
+    int lane = count++;
+    fromX[lane] = from.x;
+    fromY[lane] = from.y;
+    toX[lane] = to.x;
+    toY[lane] = to.y;
+    this->startTime[lane] = startTime;
+    endTime[lane] = startTime + (millis > 0 ? millis : 0);
+    this->easing[lane] = easing;
+    owners[lane] = owner;
+    return lane;
+}
+
+void AnimatorLanes::remove(int lane) {
+    int last = --count;
+    owners[lane]->lane = -1;
+    if (lane != last) {
+        fromX[lane] = fromX[last];
+        fromY[lane] = fromY[last];
+        toX[lane] = toX[last];
+        toY[lane] = toY[last];
+        startTime[lane] = startTime[last];
+        endTime[lane] = endTime[last];
+        easing[lane] = easing[last];
+        owners[lane] = owners[last];
+        owners[lane]->lane = lane;
+    }
+}
+
+Point2 AnimatorLanes::positionAt(int lane, float time) const {
+    float duration = endTime[lane] - startTime[lane];
+    if (time >= endTime[lane] || duration <= 0)
+        return Point2(toX[lane], toY[lane]);
+    if (time <= startTime[lane])
+        return Point2(fromX[lane], fromY[lane]);
+    float t = ease(easing[lane], (time - startTime[lane]) / duration);
+    return Point2(fromX[lane] + (toX[lane] - fromX[lane])*t, fromY[lane] + (toY[lane] - fromY[lane])*t);
+}
+
+void AnimatorLanes::ended(float time, std::vector<int>& lanes) const {
+    lanes.clear();
+    const float* endTime = this->endTime.data();
+    int k = 0;
+#ifdef __SSE2__
+    // four timestamps per compare. Most tracks are still running and the whole block is skipped.
+    const __m128 now = _mm_set1_ps(time);
+    for (; k + 4 <= count; k += 4) {
+        int mask = _mm_movemask_ps(_mm_cmple_ps(_mm_loadu_ps(endTime+k), now));
+        while (mask) {
+            int bit = __builtin_ctz(mask);
+            lanes.push_back(k + bit);
+            mask &= mask - 1;
+        }
+    }
+#endif
+    for (; k < count; k++)
+        if (endTime[k] <= time)
+            lanes.push_back(k);
+}
+
+
+// Nothing moves here, positions are worked out when drawn. The clock advances and the tracks that are over go.
+void Animations::tick() {
+    TRACE_SCOPE("Animations::tick");
+    ticks ++;
+    lanes.ended(time(), ended);
+    // backwards, so that the lane moving into a released one is one we are done with
+    for (int k = ended.size()-1; k >= 0; k--) {
+        Animator* animator = lanes.owners[ended[k]];
+        release(animator->removeIndex, animator, true);
+    }
+}
+
+void Animations::start(Animator* animator, Sprite* sprite, const Point2& pos, float millis, Easing easing) {
+    float now = time();
+    Point2 from = positionOf(sprite, now);
+    if (sprite->animator)
+        release(sprite->animator->removeIndex, sprite->animator, false); // the new track takes over from here
+
+    animator->sprite = sprite;
+    animator->lane = lanes.add(animator, from, pos, now, millis, easing);
+    sprite->animator = animator;
+    sprite->pos = pos;
+}
+
+Point2 Animations::positionOf(const Sprite* sprite, float time) const {
+    if (!sprite->animator || sprite->animator->lane == -1)
+        return sprite->pos;
+    return lanes.positionAt(sprite->animator->lane, time);
+}
+
+// return an available animator
+Animator* Animations::getAnimatorSlot() {
+    Animator* animatorp;
+    if (animators.dry())
+        TRACE_INSTANT("animator pool grows");
+    AnimatorPool::Index i = animators.getp(animatorp); // grows when dry
+
+    animatorp->removeIndex = i;
+    animatorp->animations = this;
+    animatorp->sprite = 0; // slots are reused
+    animatorp->lane = -1;
+    return animatorp;
+}
+
+// a sprite about to be destroyed should not be ticked anymore
+void Animations::cancel(Sprite* sprite) {
+    if (sprite->animator)
+        release(sprite->animator->removeIndex, sprite->animator, false);
+}
+
+void Animations::clear() {
+    AnimatorPool::Index it, nextit;
+
+    it = animators.iter();
+
+    Animator* animp;
+    while (it != -1) {
+        nextit = animators.nextp(it, animp);
+        release(it, animp, false);
+        it = nextit;
+    }
+    settled.clear();
+}
+
+void Animations::release(AnimatorPool::Index it, Animator* animator, bool finished) {
+    Sprite* sprite = animator->sprite;
+    if (animator->lane != -1)
+        lanes.remove(animator->lane);
+    animators.release(it);
+    if (!sprite)
+        return; // never set()
+    sprite->animator = 0;
+    if (finished && events)
+        events->post(EVENT_ANIMATION_DONE, (int64_t) (intptr_t) sprite);
+    if (!trackSettled)
+        return;
+    if (finished) {
+        settled.push_back(sprite);
+    } else {
+        // a cancelled sprite is about to be destroyed, or moves again. Don't leave it behind.
+        for (size_t k=0; k < settled.size(); k++) {
+            if (settled[k] == sprite) {
+                settled[k] = settled.back();
+                settled.pop_back();
+                break;
+            }
+        }
+    }
+}
@@ -0,0 +1,142 @@
+#ifndef _SPRITE_H_
+#define _SPRITE_H_
+
+// Sprites, their positions and animations. No SDL in here, so the game rules can be built and run headless (see sim.cpp)
+
+#include "listpool.h"
+#include "events.h"
+#include <vector>
+
+
+struct Point2 {
+    float x;
+    float y;
+
+    Point2() : x(0), y(0) {}
+    Point2(float x, float y) : x(x), y(y) {}
+
+    Point2 operator-(const Point2& subtracted) const {
+        Point2 result;
+        result.x = x - subtracted.x;
+        result.y = y - subtracted.y;
+        return result;
+    }
+};
+
+
+class Camera {
+public:
+    Point2 worldPos;
+
+    Camera() : worldPos(Point2()) {} // place camera at world position (0,0)
+
+    void place(float worldx, float worldy) {
+        worldPos.x = worldx;
+        worldPos.y = worldy;
+    }
+};
+
+
+// forward declarations. Both live in engine.h and are only needed when rendering.
+class Renderable;
+class Engine;
+struct Animator;
+
+class Sprite {
+public:
+    const Renderable* renderable; // not owned, may be shared with other sprites. Null when running headless.
+    Point2 pos; // where the sprite rests. While animating, where it is heading. See Animations::positionOf().
+    Animator* animator = 0; // the animation moving the sprite right now, if any. Kept by Animations.
+
+    Sprite(const Renderable* renderable) : renderable(renderable) {}
+
+    void setPos(float x, float y);
+    void setPos(const Point2& pos) {
+        this->pos = pos;
+    }
+    void render(Engine* engine); // defined in engine.cpp
+
+};
+
+struct Animations;
+typedef ListPool<Animator,int> AnimatorPool;
+
+enum Easing {
+    EASE_LINEAR,
+    EASE_IN, // starts slow, speeds up. Falling.
+    EASE_OUT, // slows down towards the end
+    EASE_IN_OUT
+};
+
+float ease(Easing easing, float t); // t in 0..1
+
+// moving a sprite is done by an animator. It is a handle to a lane of AnimatorLanes, which holds the track the sprite
+// follows. Get one from Animations::getAnimatorSlot() and set() it.
+struct Animator {
+    AnimatorPool::Index removeIndex;
+    Sprite* sprite;
+    Animations* animations = 0;
+    int lane = -1; // in animations->lanes, -1 until set()
+
+    Animator() : sprite(0) {}
+
+    // initiate the animation. The sprite moves from where it is now to 'pos' in 'millis'. An animation already
+    // moving the sprite is replaced.
+    void set(Sprite* sprite, Point2 pos, float millis, Easing easing = EASE_LINEAR);
+};
+
+// The running animations as parallel arrays, one lane per animator, packed at [0, count). A lane is a track: start
+// and end position, start and end time and an easing curve. Positions are not stepped, they are worked out from the
+// time when someone asks (Animations::positionOf()), and a track is over when its end time has passed. The arrays
+// grow along with the animator pool.
+struct AnimatorLanes {
+    std::vector<float> fromX, fromY;
+    std::vector<float> toX, toY;
+    std::vector<float> startTime, endTime; // millis
+    std::vector<Easing> easing;
+    std::vector<Animator*> owners; // to fix Animator::lane when a lane moves
+    int count = 0;
+
+    AnimatorLanes(int capacity);
+    void reserve(int capacity);
+
+    int add(Animator* owner, const Point2& from, const Point2& to, float startTime, float millis, Easing easing); // returns the lane
+    void remove(int lane); // the last lane takes its place
+    Point2 positionAt(int lane, float time) const;
+    void ended(float time, std::vector<int>& lanes) const; // lanes whose end time is not after 'time', ascending
+};
+
+// the running animations
+struct Animations {
+    AnimatorPool animators; // handles
+    AnimatorLanes lanes; // tracks
+    int ticks = 0; // simulation ticks so far
+    float tickMillis = 1000/60.0f; // simulated time per tick
+    bool trackSettled = false; // when set, sprites that stop moving are collected in 'settled'
+    std::vector<Sprite*> settled; // sprites whose last animator finished. Whoever turned trackSettled on empties it.
+    EventQueue* events = 0; // not owned. When set, finished animations are posted here (EVENT_ANIMATION_DONE).
+
+    // 'count' animations fit without allocating. More make the pools grow.
+    Animations(int count = 10) : animators(count, true), lanes(count) {}
+    ~Animations() {}
+
+    inline float time() const { return ticks*tickMillis; } // millis
+
+    // advance the clock by a tick and retire the animations that are over
+    void tick();
+    Animator* getAnimatorSlot(); // never null, the pool grows if it has to
+    void cancel(Sprite* sprite); // drop any animation still moving 'sprite'
+    void clear(); // drop all animations
+
+    // where 'sprite' is at 'time'. Sprites that don't move are at their pos.
+    Point2 positionOf(const Sprite* sprite, float time) const;
+
+private:
+    std::vector<int> ended; // tick() work area
+    void start(Animator* animator, Sprite* sprite, const Point2& pos, float millis, Easing easing);
+    void release(AnimatorPool::Index it, Animator* animator, bool finished);
+
+    friend struct Animator;
+};
+
+#endif
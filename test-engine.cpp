@@ -1,10 +1,10 @@
 #include "utils.h"
-LogStream infoLog(std::cout);
-LogStream errorLog(std::cerr);
-LogStream warningLog(std::cerr);
+LogStream<LOG_INFO> infoLog(std::cout);
+LogStream<LOG_ERROR> errorLog(std::cerr);
+LogStream<LOG_WARNING> warningLog(std::cerr);
 
 #include "engine.h"
-#include "game.h"
+#include "gameview.h"
 
 
 int main(int argc, char** args) {
@@ -24,7 +24,7 @@ int main(int argc, char** args) {
     resources->registerImage("./files/blue.png", BLUE_BLOCK);
     resources->done();
 
-    Renderable* renderable1 = new RenderableBitmap(resources->getImage(RED_BLOCK), 64, 64);
+    Renderable* renderable1 = new RenderableBitmap(resources, resources->acquireImage(RED_BLOCK), 64, 64);
     Sprite* sprite1 = new Sprite(renderable1);
     sprite1->setPos(56,66);
 
@@ -83,6 +83,8 @@ int main(int argc, char** args) {
         SDL_RenderClear(engine.renderer );
 
         sprite1->render(&engine);
+        if (engine.batching)
+            engine.batch.flush(engine.renderer);
 
         // page flipping (?)
         SDL_RenderPresent(engine.renderer);
@@ -96,7 +98,7 @@ int main(int argc, char** args) {
     }
 
     delete sprite1;
-    delete (RenderableBitmap*) renderable1;
+    delete renderable1;
 
     if (animations)
         delete animations;
@@ -0,0 +1,82 @@
+#include "trace.h"
+#include "utils.h"
+#include <chrono>
+#include <stdio.h>
+
+extern LogStream<LOG_ERROR> errorLog;
+
+Tracer tracer;
+
+// small ids in the order threads first trace, the main thread is usually 0
+static int threadId() {
+    static std::atomic<int> threads {0};
+    thread_local int id = threads++;
+    return id;
+}
+
+
+int64_t Tracer::now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void Tracer::start(int capacity) {
+    events.resize(capacity > 0 ? capacity : 1);
+    next = 0;
+    dropped = 0;
+    origin = now();
+    enabled = true;
+}
+
+void Tracer::stop() {
+    enabled = false;
+}
+
+void Tracer::record(const char* name, int64_t start, int64_t duration) {
+    // once full, stop claiming slots, so that 'next' can't overflow however long the run
+    int slot = next.load(std::memory_order_relaxed) < (int) events.size() ? next.fetch_add(1, std::memory_order_relaxed) : -1;
+    if (slot == -1 || slot >= (int) events.size()) {
+        dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    TraceEvent& event = events[slot];
+    event.name = name;
+    event.start = start;
+    event.duration = duration;
+    event.thread = threadId();
+}
+
+int Tracer::getCount() const {
+    int claimed = next.load();
+    return claimed < (int) events.size() ? claimed : events.size();
+}
+
+long Tracer::getDropped() const {
+    return dropped.load();
+}
+
+// Complete ("X") and instant ("i") events, micros since start()
+bool Tracer::writeJson(const char* filename) const {
+    FILE* out = fopen(filename, "w");
+    if (!out) {
+        errorLog << "Can't write trace to " << filename << "\n";
+        return false;
+    }
+    fprintf(out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    int count = getCount();
+    for (int k=0; k < count; k++) {
+        const TraceEvent& event = events[k];
+        double ts = (event.start - origin) * 0.001;
+        if (event.duration < 0)
+            fprintf(out, "{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":1,\"tid\":%d}", event.name, ts, event.thread);
+        else
+            fprintf(out, "{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%d}", event.name, ts,
+                    event.duration * 0.001, event.thread);
+        fprintf(out, k+1 < count ? ",\n" : "\n");
+    }
+    fprintf(out, "]}\n");
+    if (fclose(out) != 0) {
+        errorLog << "Can't write trace to " << filename << "\n";
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,82 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+// Timeline tracing. No SDL in here.
+
+#include <stdint.h>
+#include <atomic>
+#include <vector>
+
+// Records what ran when, on which thread, into a buffer allocated by start(), and writes it out as a Chrome trace
+// (JSON) that chrome://tracing and ui.perfetto.dev open. Until start() is called every marker costs a load and a
+// branch. Builds that define NO_TRACE leave the TRACE_ macros out altogether.
+//
+// Names must outlive the tracer, string literals or FrameTimer::phaseNames. They are written out as they are.
+class Tracer {
+private:
+    struct TraceEvent {
+        const char* name;
+        int64_t start; // nanos, steady clock
+        int64_t duration; // nanos. -1 for instant events.
+        int thread;
+    };
+
+    std::atomic<bool> enabled {false};
+    std::vector<TraceEvent> events;
+    std::atomic<int> next {0}; // claimed slots. Past the capacity by at most one per tracing thread.
+    std::atomic<long> dropped {0};
+    int64_t origin = 0;
+
+    void record(const char* name, int64_t start, int64_t duration);
+
+public:
+    Tracer() {}
+    Tracer(const Tracer&) = delete;
+    Tracer& operator=(const Tracer&) = delete;
+
+    static int64_t now(); // nanos, the clock FrameTimer uses
+
+    void start(int capacity = 1 << 20); // events. Anything past that is dropped and counted.
+    void stop();
+    inline bool isEnabled() const { return enabled.load(std::memory_order_relaxed); }
+
+    // from any thread
+    inline void complete(const char* name, int64_t start, int64_t end) { record(name, start, end - start); }
+    inline void instant(const char* name) { record(name, now(), -1); }
+
+    int getCount() const;
+    long getDropped() const;
+
+    // after stop(), once no other thread traces
+    bool writeJson(const char* filename) const;
+};
+
+extern Tracer tracer;
+
+// traces the rest of the enclosing block
+class TraceScope {
+private:
+    const char* name;
+    int64_t started;
+
+public:
+    inline TraceScope(const char* name) : name(name), started(tracer.isEnabled() ? Tracer::now() : 0) {}
+    inline ~TraceScope() {
+        if (started)
+            tracer.complete(name, started, Tracer::now());
+    }
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+};
+
+#ifdef NO_TRACE
+#define TRACE_SCOPE(name)
+#define TRACE_INSTANT(name)
+#else
+#define TRACE_CONCAT2(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT2(a, b)
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(traceScope, __LINE__)(name)
+#define TRACE_INSTANT(name) do { if (tracer.isEnabled()) tracer.instant(name); } while (0)
+#endif
+
+#endif // TRACE_H
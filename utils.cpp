@@ -1,21 +1,245 @@
 #include "utils.h"
 
 #include <stdlib.h>
+#include <stdio.h>
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
 
-LogStream& LogStream::operator<<(const char* arg) {
-    out << arg;
-    out.flush();
-    return *this;
+#define LOG_RING_SHIFT 16 // 64K of text waiting per thread
+#define LOG_FLUSH_MILLIS 10
+
+
+namespace {
+
+// Text logged by one thread, waiting to be written. Single producer, single consumer: the thread appends, the logger
+// thread takes. No locks. When the ring is full the text is dropped and counted.
+// Text is handed to the consumer a line at a time, so that lines of different threads don't get mixed up.
+class LogRing {
+private:
+    struct Record {
+        std::ostream* out;
+        uint32_t length; // of the text following the record
+    };
+
+    std::vector<char> bytes;
+    uint64_t mask;
+    std::atomic<uint64_t> head {0}; // consumer
+    std::atomic<uint64_t> tail {0}; // producer, up to the last whole line
+    uint64_t written = 0; // producer only, past 'tail' while a line is unfinished
+    std::atomic<long> dropped {0};
+
+    void copyIn(uint64_t position, const void* data, size_t length) {
+        size_t start = position & mask;
+        size_t first = std::min(length, bytes.size() - start);
+        memcpy(&bytes[start], data, first);
+        memcpy(&bytes[0], (const char*) data + first, length - first);
+    }
+
+public:
+    LogRing(int capacityShift) : bytes((size_t) 1 << capacityShift), mask(((uint64_t) 1 << capacityShift) - 1) {}
+
+    void append(std::ostream& out, const char* text, size_t length) {
+        uint64_t at = written;
+        uint64_t free = bytes.size() - (at - head.load(std::memory_order_acquire));
+        if (sizeof(Record) + length > free) {
+            dropped.fetch_add(length, std::memory_order_relaxed);
+            return;
+        }
+        Record record;
+        record.out = &out;
+        record.length = length;
+        copyIn(at, &record, sizeof(record));
+        copyIn(at + sizeof(record), text, length);
+        written = at + sizeof(record) + length;
+        if ((length && text[length-1] == '\n') || written - tail.load(std::memory_order_relaxed) > bytes.size() / 2)
+            publish();
+    }
+
+    // producer side, hands over an unfinished line too
+    inline void publish() {
+        tail.store(written, std::memory_order_release);
+    }
+
+    // consumer side. Streams written to are added to 'touched'.
+    void writeOut(std::vector<std::ostream*>& touched) {
+        uint64_t at = head.load(std::memory_order_relaxed);
+        uint64_t end = tail.load(std::memory_order_acquire);
+        while (at < end) {
+            Record record;
+            size_t start = at & mask;
+            size_t first = std::min(sizeof(record), bytes.size() - start);
+            memcpy(&record, &bytes[start], first);
+            memcpy((char*) &record + first, &bytes[0], sizeof(record) - first);
+            at += sizeof(record);
+
+            start = at & mask;
+            first = std::min((size_t) record.length, bytes.size() - start);
+            record.out->write(&bytes[start], first);
+            record.out->write(&bytes[0], record.length - first);
+            at += record.length;
+            if (touched.empty() || touched.back() != record.out)
+                touched.push_back(record.out);
+        }
+        head.store(at, std::memory_order_release);
+    }
+
+    inline long takeDropped() { return dropped.exchange(0); }
+};
+
+// Owns the rings of all threads and the thread writing them out. Never destroyed, so that threads may log at any
+// time, even from static destructors. What happens at exit is explicit instead:
+//   - a thread that exits gives its ring back, written out, and the next thread to log takes it over
+//   - stop() runs from atexit(). It writes everything out and from then on write() goes to the stream right away.
+class LogWriter {
+private:
+    std::mutex mutex; // the ring lists and the consumer side of the rings
+    std::condition_variable wake;
+    std::vector<std::unique_ptr<LogRing>> rings; // all of them, spare or not
+    std::vector<LogRing*> spare; // given back by threads that exited
+    std::vector<std::ostream*> touched;
+    std::thread thread;
+    std::atomic<bool> stopped {false};
+
+    void writeOutLocked() {
+        for (size_t k=0; k < rings.size(); k++) {
+            rings[k]->writeOut(touched);
+            long dropped = rings[k]->takeDropped();
+            if (dropped) {
+                std::cerr << "[" << dropped << " bytes of log dropped]\n";
+                touched.push_back(&std::cerr);
+            }
+        }
+        for (size_t k=0; k < touched.size(); k++)
+            touched[k]->flush();
+        touched.clear();
+    }
+
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!stopped) {
+            wake.wait_for(lock, std::chrono::milliseconds(LOG_FLUSH_MILLIS));
+            writeOutLocked();
+        }
+    }
+
+public:
+    inline bool isStopped() const { return stopped.load(std::memory_order_relaxed); }
+
+    LogRing* attach() {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!thread.joinable() && !stopped)
+            thread = std::thread(&LogWriter::run, this);
+        if (!spare.empty()) {
+            LogRing* ring = spare.back();
+            spare.pop_back();
+            return ring;
+        }
+        rings.push_back(std::unique_ptr<LogRing>(new LogRing(LOG_RING_SHIFT)));
+        return rings.back().get();
+    }
+
+    void detach(LogRing* ring) {
+        ring->publish();
+        std::lock_guard<std::mutex> lock(mutex);
+        writeOutLocked();
+        spare.push_back(ring);
+    }
+
+    void writeOut() {
+        std::lock_guard<std::mutex> lock(mutex);
+        writeOutLocked();
+    }
+
+    // after stop(). What is still in the rings goes first, to keep the order.
+    void writeNow(std::ostream& out, const char* text, size_t length) {
+        std::lock_guard<std::mutex> lock(mutex);
+        writeOutLocked();
+        out.write(text, length);
+        out.flush();
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopped = true;
+        }
+        wake.notify_one();
+        if (thread.joinable())
+            thread.join();
+        writeOut();
+    }
+};
+
+LogWriter& logWriter() {
+    static LogWriter* writer = 0;
+    static std::once_flag created;
+    std::call_once(created, [] {
+        writer = new LogWriter(); // never deleted, see LogWriter
+        atexit([] { writer->stop(); });
+    });
+    return *writer;
 }
 
-LogStream& LogStream::operator<<(int arg) {
-    out << arg;
-    out.flush();
-    return *this;
+thread_local LogRing* threadRing = 0;
+thread_local bool threadExited = false; // its ring is given back already
+
+// gives the ring of a thread back when the thread exits
+struct RingOwner {
+    ~RingOwner() {
+        logWriter().detach(threadRing);
+        threadRing = 0;
+        threadExited = true;
+    }
+};
+
+}
+
+
+void Logger::write(std::ostream& out, const char* text, size_t length) {
+    LogWriter& writer = logWriter();
+    if (!threadRing && !threadExited && !writer.isStopped()) {
+        thread_local RingOwner owner;
+        threadRing = writer.attach();
+    }
+    if (threadRing && !writer.isStopped())
+        threadRing->append(out, text, length);
+    else
+        writer.writeNow(out, text, length);
+}
+
+void Logger::writeSigned(std::ostream& out, long long arg) {
+    char text[24];
+    std::to_chars_result result = std::to_chars(text, text + sizeof(text), arg);
+    write(out, text, result.ptr - text);
+}
+
+void Logger::writeUnsigned(std::ostream& out, unsigned long long arg) {
+    char text[24];
+    std::to_chars_result result = std::to_chars(text, text + sizeof(text), arg);
+    write(out, text, result.ptr - text);
+}
+
+// like std::ostream does by default
+void Logger::writeFloat(std::ostream& out, double arg) {
+    char text[32];
+    int length = snprintf(text, sizeof(text), "%g", arg);
+    write(out, text, length);
+}
+
+void Logger::flush() {
+    if (threadRing)
+        threadRing->publish();
+    logWriter().writeOut();
 }
 
 // from https://stackoverflow.com/questions/1202687/how-do-i-get-a-specific-range-of-numbers-from-rand
 int randomInRange(int min, int max) {
     return rand() % (max + 1 - min) + min;
 }
-
@@ -2,18 +2,61 @@
 #define _UTILS_H_
 
 #include <iostream>
+#include <string>
+#include <stdint.h>
+#include <string.h>
 
 
+// Levels below LOG_MIN_LEVEL are compiled out, e.g. -DLOG_MIN_LEVEL=LOG_WARNING. Their operator<< is empty, only the
+// arguments are still evaluated.
+enum LogLevel {
+	LOG_INFO,
+	LOG_WARNING,
+	LOG_ERROR
+};
+
+#ifndef LOG_MIN_LEVEL
+#define LOG_MIN_LEVEL LOG_INFO
+#endif
+
+// What every LogStream writes through. Formatting happens on the calling thread, into that thread's ring, and writing
+// to the std::ostream in the background. Writing the rings out happens every few milliseconds, when a thread exits and
+// once more at exit, so text logged right before a crash may be lost. Call flush() where that matters. Logging from
+// static destructors is fine, it is written right away.
+class Logger {
+public:
+	static void write(std::ostream& out, const char* text, size_t length);
+	static void writeSigned(std::ostream& out, long long arg);
+	static void writeUnsigned(std::ostream& out, unsigned long long arg);
+	static void writeFloat(std::ostream& out, double arg);
+	static void flush(); // writes out what was logged so far, from the calling thread
+};
+
+template<LogLevel LEVEL>
 class LogStream {
 private:
 	std::ostream& out;
+
+	inline void write(const char* text, size_t length) { Logger::write(out, text, length); }
+	inline void writeSigned(long long arg) { Logger::writeSigned(out, arg); }
+	inline void writeUnsigned(unsigned long long arg) { Logger::writeUnsigned(out, arg); }
+	inline void writeFloat(double arg) { Logger::writeFloat(out, arg); }
+
 public:
 
 	LogStream(std::ostream& out) : out(out) {}
 
-	LogStream& operator<<(const char* arg);
+	inline LogStream& operator<<(const char* arg) { if (LEVEL >= LOG_MIN_LEVEL) write(arg, strlen(arg)); return *this; }
+	inline LogStream& operator<<(const std::string& arg) { if (LEVEL >= LOG_MIN_LEVEL) write(arg.data(), arg.size()); return *this; }
+	inline LogStream& operator<<(char arg) { if (LEVEL >= LOG_MIN_LEVEL) write(&arg, 1); return *this; }
     
-	LogStream& operator<<(int arg);
+	inline LogStream& operator<<(int arg) { if (LEVEL >= LOG_MIN_LEVEL) writeSigned(arg); return *this; }
+	inline LogStream& operator<<(long arg) { if (LEVEL >= LOG_MIN_LEVEL) writeSigned(arg); return *this; }
+	inline LogStream& operator<<(long long arg) { if (LEVEL >= LOG_MIN_LEVEL) writeSigned(arg); return *this; }
+	inline LogStream& operator<<(unsigned arg) { if (LEVEL >= LOG_MIN_LEVEL) writeUnsigned(arg); return *this; }
+	inline LogStream& operator<<(unsigned long arg) { if (LEVEL >= LOG_MIN_LEVEL) writeUnsigned(arg); return *this; }
+	inline LogStream& operator<<(unsigned long long arg) { if (LEVEL >= LOG_MIN_LEVEL) writeUnsigned(arg); return *this; }
+	inline LogStream& operator<<(double arg) { if (LEVEL >= LOG_MIN_LEVEL) writeFloat(arg); return *this; }
     
 };
 